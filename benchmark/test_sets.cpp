@@ -7,7 +7,7 @@ using V = unsigned long;
 #include "parse_command_line.h"
 
 int main(int argc, char* argv[]) {
-  commandLine P(argc,argv,"[-n <size>] [-r <rounds>] [-threads <num threads>] [-z <zipfian_param>] [-u <update percent>] [-mfind <multifind percent>] [-range <range query percent>] [-rs <range query size>] [-dense] [-simple_test] [-insert_find_delete] [-verbose] [-shuffle] [-stats] [-no_check] [-rqthreads <num range query threads>]");
+  commandLine P(argc,argv,"[-n <size>] [-r <rounds>] [-threads <num threads>] [-z <zipfian_param>] [-u <update percent>] [-mfind <multifind percent>] [-range <range query percent>] [-rs <range query size>] [-dense] [-simple_test] [-insert_find_delete] [-verbose] [-shuffle] [-huge <thp|2m|1g>] [-reserve] [-stats] [-no_check] [-rqthreads <num range query threads>]");
 
 #ifdef HASH
   struct IntHash {
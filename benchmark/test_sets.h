@@ -2,6 +2,8 @@
 #include <iostream>
 #include <sstream>
 #include <limits>
+#include <map>
+#include <thread>
 
 #include <parlay/primitives.h>
 #include <parlay/random.h>
@@ -20,6 +22,491 @@ void assert_key_exists(bool b) {
   }
 }
 
+void sanity_check(bool b, const char* what) {
+  if (!b) {
+    std::cout << "sanity check failed: " << what << std::endl;
+    abort();
+  }
+}
+
+// Detects the optional parts of the interface, so the sanity checks
+// only run what a structure supports.
+template <typename S, typename = void>
+struct has_multi_ops : std::false_type {};
+template <typename S>
+struct has_multi_ops<S, std::void_t<decltype(
+  std::declval<S&>().multi_remove(std::declval<parlay::sequence<unsigned long>&>()))>>
+  : std::true_type {};
+
+// Checks multi_insert, multi_find and multi_remove against std::map,
+// with duplicate and absent keys in the batches.
+template <typename SetType>
+void test_multi_ops() {
+  using key_type = unsigned long;
+  long n = 5000;
+  auto tr = SetType(n);
+  std::map<key_type, key_type> ref;
+  auto kvs = parlay::tabulate(n, [] (long i) {
+    key_type k = parlay::hash64(i) % 4000 + 1;
+    return std::pair(k, 2 * k);});
+  long inserted = tr.multi_insert(kvs);
+  for (auto [k, v] : kvs) ref.insert({k, v});
+  sanity_check(inserted == (long) ref.size(), "multi_insert count");
+
+  auto keys = parlay::tabulate(n, [] (long i) {return (key_type) i;});
+  parlay::sequence<std::optional<key_type>> out(n);
+  tr.multi_find(keys, out);
+  for (long i = 0; i < n; i++) {
+    auto it = ref.find(keys[i]);
+    sanity_check(it == ref.end() ? !out[i].has_value()
+                 : out[i].has_value() && *out[i] == it->second, "multi_find");
+  }
+
+  auto rkeys = parlay::tabulate(n / 2, [&] (long i) {
+    return (key_type) parlay::hash64(n + i) % 5000;});
+  long removed = tr.multi_remove(rkeys);
+  long ref_removed = 0;
+  for (auto k : rkeys) ref_removed += ref.erase(k);
+  sanity_check(removed == ref_removed, "multi_remove count");
+  for (long i = 0; i < n; i++)
+    sanity_check(tr.find(keys[i]).has_value() == (ref.count(keys[i]) > 0),
+                 "find after multi_remove");
+}
+
+// The fixture shared by the ordered checks: tr and ref are filled
+// with the keys 10, 20, ..., 10n in random order (each with value
+// key + 1), and then every 7th is removed, so the keys span many
+// leaves with gaps between them.
+using ref_map = std::map<unsigned long, unsigned long>;
+using kv_opt = std::optional<std::pair<unsigned long, unsigned long>>;
+
+template <typename SetType>
+void fill_with_gaps(SetType& tr, ref_map& ref, long n) {
+  auto keys = parlay::random_shuffle(parlay::tabulate(n, [] (long i) {
+    return (unsigned long) 10 * (i + 1);}));
+  for (auto k : keys) {tr.insert(k, k + 1); ref.insert({k, k + 1});}
+  for (long i = 0; i < n; i += 7) {tr.remove(keys[i]); ref.erase(keys[i]);}
+}
+
+// the entry at it, or none at the end
+kv_opt ref_entry(const ref_map& ref, ref_map::const_iterator it) {
+  if (it == ref.end()) return {};
+  return *it;
+}
+
+template <typename S, typename = void>
+struct has_ordered_queries : std::false_type {};
+template <typename S>
+struct has_ordered_queries<S, std::void_t<decltype(
+  std::declval<S&>().lower_bound(0ul), std::declval<S&>().predecessor(0ul))>>
+  : std::true_type {};
+
+// Checks min, max, and lower_bound, successor and predecessor at every
+// multiple of 5 up to max_key, against ref (non-empty).
+template <typename SetType>
+void check_ordered_queries(SetType& tr, const ref_map& ref, unsigned long max_key) {
+  auto ref_pred = [&] (unsigned long k) -> kv_opt {
+    auto it = ref.lower_bound(k);
+    if (it == ref.begin()) return {};
+    return ref_entry(ref, --it);};
+  sanity_check(tr.min() == ref_entry(ref, ref.begin()), "min");
+  sanity_check(tr.max() == ref_entry(ref, --ref.end()), "max");
+  for (unsigned long k = 0; k <= max_key; k += 5) {
+    sanity_check(tr.lower_bound(k) == ref_entry(ref, ref.lower_bound(k)), "lower_bound");
+    sanity_check(tr.successor(k) == ref_entry(ref, ref.upper_bound(k)), "successor");
+    sanity_check(tr.predecessor(k) == ref_pred(k), "predecessor");
+  }
+}
+
+// Checks lower_bound, successor, predecessor, min and max against
+// std::map, on an empty structure and then at and between every key,
+// which covers the first and last keys and the leaf boundaries.
+template <typename SetType>
+void test_ordered_queries() {
+  using key_type = unsigned long;
+  auto tr = SetType(1);
+  sanity_check(!tr.min().has_value() && !tr.max().has_value() &&
+               !tr.lower_bound(5).has_value() &&
+               !tr.successor(5).has_value() &&
+               !tr.predecessor(5).has_value(), "ordered queries on empty");
+
+  long n = 3000;
+  ref_map ref;
+  fill_with_gaps(tr, ref, n);
+  check_ordered_queries(tr, ref, 10 * (n + 1));
+}
+
+template <typename S, typename = void>
+struct has_bulk_build : std::false_type {};
+template <typename S>
+struct has_bulk_build<S, std::void_t<decltype(
+  S(std::declval<const parlay::sequence<typename S::KV>&>()))>>
+  : std::true_type {};
+
+// Builds from sorted sequences (empty, and large enough for several
+// levels), and checks find, check(), size() and the ordered queries
+// against std::map, before and after later inserts and removes.
+template <typename SetType>
+void test_bulk_build() {
+  using key_type = unsigned long;
+  using KV = typename SetType::KV;
+  auto empty = SetType(parlay::sequence<KV>());
+  sanity_check(empty.check() == 0 && !empty.find(10).has_value(), "build of empty");
+
+  long n = 20000;
+  auto kvs = parlay::filter(parlay::tabulate(n, [] (long i) {
+    key_type k = 10 * (i + 1);
+    return KV{k, k + 1};}), [] (KV kv) {return kv.key % 70 != 0;});
+  ref_map ref;
+  for (auto kv : kvs) ref.insert({kv.key, kv.value});
+  auto tr = SetType(kvs);
+  key_type max_key = 10 * (n + 1);
+  auto check_all = [&] (const char* what) {
+    sanity_check(tr.check() == (long) ref.size() &&
+		 tr.size() == (long) ref.size(), what);
+    for (key_type k = 0; k <= max_key; k += 5) {
+      auto it = ref.find(k);
+      sanity_check(tr.find(k) == (it == ref.end() ? std::optional<key_type>()
+				  : it->second), what);
+    }
+    if constexpr (has_ordered_queries<SetType>::value)
+      check_ordered_queries(tr, ref, max_key);
+  };
+  check_all("after build");
+
+  for (key_type k = 5; k <= max_key; k += 30) {tr.insert(k, k + 1); ref.insert({k, k + 1});}
+  for (key_type k = 20; k <= max_key; k += 40) {tr.remove(k); ref.erase(k);}
+  check_all("after inserts and removes into a built tree");
+}
+
+template <typename S, typename = void>
+struct has_multi_update : std::false_type {};
+template <typename S>
+struct has_multi_update<S, std::void_t<decltype(
+  std::declval<S&>().multi_update(std::declval<parlay::sequence<
+    std::pair<unsigned long, std::optional<unsigned long>>>&>()))>>
+  : std::true_type {};
+
+// Checks multi_update against std::map with batches of mixed upserts
+// and removes (of present and absent keys) large enough to split
+// leaves, then a batch removing a long run of keys so leaves are
+// joined.  The returned net count is checked against size().
+template <typename SetType>
+void test_multi_update() {
+  using key_type = unsigned long;
+  using batch = parlay::sequence<std::pair<key_type, std::optional<key_type>>>;
+  auto tr = SetType(1);
+  ref_map ref;
+  auto apply = [&] (const batch& b, const char* what) {
+    long before = tr.size();
+    long ref_before = ref.size();
+    long delta = tr.multi_update(b);
+    for (auto [k, v] : b)
+      if (v.has_value()) ref[k] = *v;
+      else ref.erase(k);
+    sanity_check(delta == (long) ref.size() - ref_before &&
+		 tr.size() == before + delta &&
+		 tr.size() == (long) ref.size() &&
+		 tr.check() == (long) ref.size(), what);
+    for (key_type k = 0; k < 41000; k++) {
+      auto it = ref.find(k);
+      sanity_check(tr.find(k) == (it == ref.end() ? std::optional<key_type>()
+				  : it->second), what);
+    }
+  };
+
+  // upserts of every other key, into a single leaf to start with
+  apply(parlay::tabulate(20000, [] (long i) {
+    key_type k = 2 * i + 1;
+    return std::pair(k, std::optional<key_type>(k));}), "multi_update inserts");
+
+  // a mix of upserts and removes, present and absent
+  apply(parlay::tabulate(40000, [] (long i) {
+    key_type k = i + 1;
+    switch (parlay::hash64(i) % 3) {
+    case 0: return std::pair(k, std::optional<key_type>());
+    case 1: return std::pair(k, std::optional<key_type>(2 * k));
+    default: return std::pair(k, std::optional<key_type>(3 * k));}}),
+    "multi_update upserts and removes");
+
+  // removes a long run, leaving leaves underfull
+  apply(parlay::tabulate(30000, [] (long i) {
+    return std::pair((key_type) 5000 + i, std::optional<key_type>());}),
+    "multi_update removes");
+}
+
+// a read-modify-write function for upsert, adding 100 to the value
+struct add_100 {
+  unsigned long operator()(std::optional<unsigned long> v) const {
+    return v.has_value() ? *v + 100 : 0;}
+};
+
+template <typename S, typename = void>
+struct has_upsert_f : std::false_type {};
+template <typename S>
+struct has_upsert_f<S, std::void_t<decltype(
+  std::declval<S&>().upsert(0ul, add_100()))>>
+  : std::true_type {};
+
+template <typename S, typename = void>
+struct has_update : std::false_type {};
+template <typename S>
+struct has_update<S, std::void_t<decltype(
+  std::declval<S&>().update(0ul, add_100()))>>
+  : std::true_type {};
+
+// Checks upsert(k, f) and update(k, f) against std::map: upsert
+// inserts f(empty) and returns true if k is absent, and otherwise
+// sets the value to f(old) and returns false; update sets the value
+// to f(old) and returns true if k is present, and otherwise changes
+// nothing and returns false.
+template <typename SetType>
+void test_upsert_update() {
+  using key_type = unsigned long;
+  long n = 3000;
+  auto tr = SetType(n);
+  ref_map ref;
+  for (key_type k = 2; k <= n; k += 2) {tr.insert(k, k); ref[k] = k;}
+  auto matches = [&] (const char* what) {
+    for (key_type k = 0; k <= n + 1; k++) {
+      auto it = ref.find(k);
+      sanity_check(tr.find(k) == (it == ref.end() ? std::optional<key_type>()
+				  : it->second), what);
+    }
+  };
+
+  for (key_type k = 1; k <= n; k += 3) {
+    bool absent = ref.count(k) == 0;
+    ref[k] = absent ? 0 : ref[k] + 100;
+    sanity_check(tr.upsert(k, add_100()) == absent, "upsert returns whether inserted");
+  }
+  matches("values after upsert");
+
+  if constexpr (has_update<SetType>::value) {
+    for (key_type k = 1; k <= n + 1; k += 5) {
+      bool present = ref.count(k) > 0;
+      if (present) ref[k] += 100;
+      sanity_check(tr.update(k, add_100()) == present, "update returns whether present");
+    }
+    matches("values after update");
+  }
+}
+
+// A snapshot taken before upserts on present keys (in btree and
+// arttree leaves the first few are overwrites in place rather than
+// copies) still sees the old values.  The snapshot reads every key,
+// lets another thread upsert them all several times, and reads them
+// again.  It is not speculative, since a restart would see the new
+// values in both reads.
+template <typename SetType>
+void test_overwrite_snapshot() {
+  using key_type = unsigned long;
+  long n = 12;
+  int rounds = 6;
+  auto tr = SetType(n);
+  for (key_type k = 1; k <= n; k++) tr.insert(k, k);
+  std::atomic<int> phase = 0;
+  std::thread writer([&] {
+    while (phase.load() < 1) std::this_thread::yield();
+    for (int r = 0; r < rounds; r++)
+      for (key_type k = 1; k <= n; k++) tr.upsert(k, add_100());
+    phase = 2;});
+  std::vector<std::optional<key_type>> before(n), after(n);
+  verlib::with_snapshot([&] {
+    for (long i = 0; i < n; i++) before[i] = tr.find_(i + 1);
+    if (phase.load() == 0) {
+      phase = 1;
+      while (phase.load() < 2) std::this_thread::yield();
+    }
+    for (long i = 0; i < n; i++) after[i] = tr.find_(i + 1);
+    return true;}, false);
+  writer.join();
+  sanity_check(before == after, "upserts are not visible to an older snapshot");
+  for (key_type k = 1; k <= n; k++)
+    sanity_check(tr.find(k) == std::optional<key_type>(k + 100 * rounds),
+		 "values after upserts");
+}
+
+template <typename S, typename = void>
+struct has_capacity : std::false_type {};
+template <typename S>
+struct has_capacity<S, std::void_t<decltype(std::declval<S&>().capacity())>>
+  : std::true_type {};
+
+// Grows a table from one bucket while another thread reads it.  The
+// writer inserts keys 1..n in order and then removes them in order,
+// and the reader checks with finds that the last key it was told of
+// is present (or absent), and with snapshots that the keys present
+// are those left by one of the writer's steps, and not an earlier one
+// than it was told of, so no key is lost during a migration.
+template <typename SetType>
+void test_resize() {
+  using key_type = unsigned long;
+  long n = 30000;
+  auto tr = SetType(1);
+  std::atomic<long> done = 0;  // keys inserted, then n + keys removed
+  std::thread writer([&] {
+    for (key_type k = 1; k <= n; k++) {tr.insert(k, k); done = k;}
+    for (key_type k = 1; k <= n; k++) {tr.remove(k); done = n + k;}});
+  for (long d = 0; d < 2 * n; d = done.load()) {
+    if (d > 0 && d <= n)
+      sanity_check(tr.find(d) == std::optional<key_type>(d), "find during resize");
+    if (d > n)
+      sanity_check(!tr.find(d - n).has_value(), "find after remove during resize");
+#ifdef Versioned
+    bool ok = verlib::with_snapshot([&] {
+      long cnt = 0, first = 0, last = 0;
+      for (key_type k = 1; k <= n; k++) {
+	auto v = tr.find_(k);
+	if (!v.has_value()) continue;
+	if (*v != k) return false;
+	if (cnt++ == 0) first = k;
+	last = k;
+      }
+      if (cnt == 0) return true;
+      if (last - first + 1 != cnt || (first != 1 && last != n)) return false;
+      // the writer's step that leaves exactly these keys
+      long step = (last == n) ? n + first - 1 : last;
+      return step >= d;});
+    sanity_check(ok, "snapshot during resize");
+#endif
+  }
+  writer.join();
+  sanity_check(tr.capacity() > 1, "table grew");
+  sanity_check(tr.check() == 0 && tr.size() == 0, "empty after resize");
+}
+
+template <typename S, typename = void>
+struct has_size : std::false_type {};
+template <typename S>
+struct has_size<S, std::void_t<decltype(std::declval<S&>().size())>>
+  : std::true_type {};
+
+// Checks size() against check() and a count of the keys after a
+// parallel mix of inserts (some of present keys), upserts of present
+// and absent keys and removes, spread over the workers, and after a
+// multi_update where supported.
+template <typename SetType>
+void test_size() {
+  using key_type = unsigned long;
+  long n = 20000;
+  auto tr = SetType(n);
+  parlay::parallel_for(0, n, [&] (long i) {
+    key_type k = i + 1;
+    tr.insert(k, k);
+    if (i % 3 == 0) tr.insert(k, k + 1);
+    if constexpr (has_upsert_f<SetType>::value) {
+      if (i % 4 == 0) tr.upsert(k, add_100());
+      if (i % 7 == 0) tr.upsert(k + n, add_100());
+    }
+    if (i % 5 == 0) tr.remove(k);
+    if (i % 11 == 0) tr.remove(k + 2 * n);}, 1);
+  long expected = 0;
+  for (long i = 0; i < n; i++)
+    expected += (i % 5 != 0) + (has_upsert_f<SetType>::value && i % 7 == 0);
+  sanity_check(tr.size() == expected && tr.check() == expected,
+	       "size after inserts, upserts and removes");
+
+  if constexpr (has_multi_update<SetType>::value) {
+    long delta = tr.multi_update(parlay::tabulate(2 * n, [] (long i) {
+      key_type k = i + 1;
+      return (i % 2 == 0) ? std::pair(k, std::optional<key_type>())
+	                  : std::pair(k, std::optional<key_type>(k));}));
+    sanity_check(tr.size() == expected + delta && tr.check() == tr.size(),
+		 "size after multi_update");
+  }
+}
+
+template <typename S, typename = void>
+struct has_desc_ranges : std::false_type {};
+template <typename S>
+struct has_desc_ranges<S, std::void_t<decltype(
+  std::declval<S&>().range_desc_limit_(0ul, 1), std::declval<S&>().cursor_desc(0ul))>>
+  : std::true_type {};
+
+// Checks range_desc_ against range_ reversed, and range_desc_limit
+// and cursors (both directions) against std::map.
+template <typename SetType>
+void test_desc_ranges() {
+  using key_type = unsigned long;
+  using kvs = std::vector<std::pair<key_type, key_type>>;
+  long n = 3000;
+  auto tr = SetType(n);
+  ref_map ref;
+  fill_with_gaps(tr, ref, n);
+
+  key_type max_key = 10 * (n + 2);
+  for (key_type s = 1; s < max_key; s += 997) {
+    for (key_type e : {s, s + 5, s + 95, s + 2000, max_key}) {
+      kvs asc, desc;
+      auto add_asc = [&] (key_type k, key_type v) {asc.push_back({k, v}); return true;};
+      auto add_desc = [&] (key_type k, key_type v) {desc.push_back({k, v}); return true;};
+      verlib::with_snapshot([&] {
+        tr.range_(add_asc, s, e);
+        tr.range_desc_(add_desc, s, e);
+        return true;});
+      std::reverse(asc.begin(), asc.end());
+      sanity_check(asc == desc, "range_desc_");
+    }
+  }
+
+  auto ref_desc = [&] (key_type from, size_t m) {
+    kvs r;
+    for (auto it = ref.upper_bound(from); it != ref.begin() && r.size() < m;)
+      r.push_back(*--it);
+    return r;};
+  auto ref_asc = [&] (key_type from, size_t m) {
+    kvs r;
+    for (auto it = ref.lower_bound(from); it != ref.end() && r.size() < m; it++)
+      r.push_back(*it);
+    return r;};
+  for (key_type from : {0ul, 5ul, 10ul, 15ul, 12345ul, 10ul * n, max_key})
+    for (size_t m : {1, 16, 100, 10000}) {
+      auto r = tr.range_desc_limit(from, m);
+      sanity_check(kvs(r.begin(), r.end()) == ref_desc(from, m), "range_desc_limit");
+    }
+
+  for (key_type from : {0ul, 15ul, 12345ul, max_key}) {
+    kvs asc, desc;
+    auto c = tr.cursor(from);
+    for (auto b = c.next_batch(7); b.size() > 0; b = c.next_batch(7))
+      asc.insert(asc.end(), b.begin(), b.end());
+    auto d = tr.cursor_desc(from);
+    for (auto b = d.next_batch(7); b.size() > 0; b = d.next_batch(7))
+      desc.insert(desc.end(), b.begin(), b.end());
+    sanity_check(asc == ref_asc(from, n) && desc == ref_desc(from, n), "cursor");
+  }
+}
+
+// std::threads that register and deregister one after the other reuse
+// an id, and threads registered at the same time get distinct ids
+void test_thread_ids() {
+  int before = flck::internal::max_worker_id();
+  for (int r = 0; r < 8; r++)
+    std::thread([] {
+      verlib::register_thread();
+      verlib::deregister_thread();}).join();
+  sanity_check(flck::internal::max_worker_id() <= before + 1,
+	       "ids of deregistered threads are reused");
+
+  int t = 4;
+  std::vector<int> ids(t);
+  std::atomic<int> registered = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < t; i++)
+    threads.emplace_back([&, i] {
+      ids[i] = verlib::register_thread();
+      registered++;
+      while (registered.load() < t) std::this_thread::yield();
+      verlib::deregister_thread();});
+  for (auto& th : threads) th.join();
+  std::sort(ids.begin(), ids.end());
+  sanity_check(std::adjacent_find(ids.begin(), ids.end()) == ids.end(),
+	       "concurrently registered threads have distinct ids");
+  sanity_check(flck::internal::max_worker_id() <= before + t,
+	       "ids are bounded by the threads registered at once");
+}
+
 void print_array(bool* a, int N) {
   for(int i = 0; i < N; i++)
     std::cout << a[i];
@@ -163,7 +650,23 @@ void test_sets(size_t default_size, commandLine P) {
       });
 
 
+    if constexpr (has_multi_ops<SetType>::value) test_multi_ops<SetType>();
+    if constexpr (has_ordered_queries<SetType>::value)
+      test_ordered_queries<SetType>();
+    if constexpr (has_desc_ranges<SetType>::value) test_desc_ranges<SetType>();
+    if constexpr (has_bulk_build<SetType>::value) test_bulk_build<SetType>();
+    if constexpr (has_multi_update<SetType>::value) test_multi_update<SetType>();
+    if constexpr (has_upsert_f<SetType>::value) test_upsert_update<SetType>();
+#ifdef Versioned
+    if constexpr (has_upsert_f<SetType>::value) test_overwrite_snapshot<SetType>();
+#endif
+    if constexpr (has_size<SetType>::value) test_size<SetType>();
+#ifndef UseCAS  // tables do not grow with UseCAS
+    if constexpr (has_capacity<SetType>::value) test_resize<SetType>();
+#endif
+
     // run persistence tests
+    test_thread_ids();
     test_persistence_concurrent<SetType>();
     std::cout << "finished sanity checks" << std::endl;
   } else {  // main test
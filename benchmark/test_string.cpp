@@ -11,9 +11,16 @@
 #include "parse_command_line.h"
 #include "timer_loops.h"
 
+// -DSTRING_KEY uses verlib::string_key, which shares one out of line
+// copy of the bytes between all copies of a key
+#ifndef STRING_KEY
 #define CHARS
+#endif
 
-#ifdef CHARS
+#ifdef STRING_KEY
+#include <verlib/string_key.h>
+using K = verlib::string_key;
+#elif defined(CHARS)
 using K = parlay::chars;
 #else
 using K = std::string;
@@ -21,9 +28,9 @@ using K = std::string;
 
 template <typename K>
 struct RadixString {
-  static int length(K key) { return key.size()+1;}
-  static int get_byte(K key, int pos) {
-    return (pos >= key.size()) ? 0 : key[pos];}
+  static int length(const K& key) { return key.size()+1;}
+  static int get_byte(const K& key, int pos) {
+    return (pos >= key.size()) ? 0 : (unsigned char) key[pos];}
 };
 
 using V = unsigned long;
@@ -33,7 +40,9 @@ using V = unsigned long;
 int main(int argc, char* argv[]) {
     commandLine P(argc,argv,"[-r <rounds>] [-threads <num threads>] [-u <update percent>] [-mfind <multifind percent>] [-rs <multifind size>] [-verbose] [-shuffle] [-stats] [-no_check] <filename>");
 
-#ifdef RADIX
+#if defined(RADIX) && defined(STRING_KEY)
+    using SetType = ordered_map<K,V,verlib::string_key_traits>;
+#elif RADIX
     using SetType = ordered_map<K,V,RadixString<K>>;
 #elif HASH
     using SetType = unordered_map<K,V,parlay::hash<K>>;
@@ -54,7 +63,7 @@ int main(int argc, char* argv[]) {
   auto a = std::move(b);
 #else
   auto a = parlay::map(std::move(b), [] (const parlay::chars& x) {
-			    return std::string(x.begin(), x.end());});
+			    return K(std::string(x.begin(), x.end()));});
 #endif
   auto unique = parlay::random_shuffle(parlay::remove_duplicates(a));
   std::cout << "total strings = " << a.size()
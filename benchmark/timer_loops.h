@@ -14,6 +14,10 @@
 //   -range_query_threads <num threads>
 // is specified then that percent of threads are dedicated to range
 // queries and the rest use the mix above.
+//   -huge <thp|2m|1g>
+// backs the memory pools with (transparent or explicit) huge pages, and
+//   -reserve
+// pre-allocates and faults them in before the first round.
 // Reports throughput.
 //
 // run_insert_find_remove:
@@ -116,6 +120,14 @@ void run_mixed_operations(parlay::sequence<K>& all,
   // clear the memory pool between rounds
   bool clear = P.getOption("-clear");
 
+  // back the memory pools with huge pages: "thp", "2m" or "1g"
+  std::string huge_pages = P.getOptionValue("-huge", "");
+  if (huge_pages != "")
+    parlay::internal::set_huge_page_mode(parlay::internal::huge_page_mode_from_string(huge_pages));
+
+  // pre-allocate (and fault in) the memory pools before the first round
+  bool reserve = P.getOption("-reserve");
+
   enum op_type : char {Find, Insert, Remove, Range, MultiFind, Trans};
  
   // initially set to all finds
@@ -135,6 +147,7 @@ void run_mixed_operations(parlay::sequence<K>& all,
       else return Find; });
 
   parlay::internal::timer t;
+  if (reserve) SetType::reserve(nn);
   if (shuffle) SetType::shuffle(n);
 
   for (int i = 0; i < rounds+1; i++) {
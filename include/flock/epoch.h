@@ -1,6 +1,11 @@
 #include <atomic>
 #include <vector>
 #include <limits>
+#include <mutex>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <typeinfo>
 
 #include "parlay/alloc.h"
 #include "parlay/primitives.h"
@@ -29,6 +34,13 @@
 //    flck::internal::epoch.before_epoch_hooks.push_back(<mythunk>);
 //    flck::internal::epoch.after_epoch_hooks.push_back(<myotherthunk>);
 
+// Metrics:
+//    flck::metrics() -> metrics_snapshot
+// returns the current epoch, the lag of each worker behind it, and for
+// every live mem_pool the number of live and retired-but-unreclaimed
+// objects (and their bytes).  All values come from counters maintained
+// on the fly, so it can be called while other threads are running.  The
+// values are not an atomic snapshot, just a consistent-enough view.
 
 // ***************************
 // epoch structure
@@ -36,25 +48,144 @@
 
 namespace flck {
 namespace internal {
-  // thread_local int __count = 0;
-
-  inline int worker_id() {
-    // if(__count++ % 1024 == 0)
-      // std::cerr << "my_thread_id: " << parlay::my_thread_id() << std::endl;
-    return parlay::my_thread_id();
-  }
 
+  // initial number of per-thread slots, more are added if more
+  // threads register
   inline int num_workers() {
     if (const auto env_p = std::getenv("PARLAY_NUM_THREADS")) {
       return std::stoi(env_p);
     } else {
       return std::thread::hardware_concurrency()+2;
     }
-    // std::cerr << "num_thread_ids: " << parlay::num_thread_ids() << std::endl;
-    // if(parlay::num_thread_ids() == 0) abort();
-    // return parlay::num_thread_ids();
   }
 
+// ***************************
+// worker ids
+// ***************************
+
+// Hands out dense ids to threads.  A thread gets an id on first use
+// (or by calling flck::register_thread()), and gives it back when it
+// exits or calls flck::deregister_thread().  Ids are recycled, so the
+// number of ids ever handed out is bounded by the maximum number of
+// threads registered at the same time.
+struct worker_id_pool {
+  std::mutex mtx;
+  std::vector<int> free_ids;
+  std::atomic<int> num_ids = 0; // ids handed out so far (including free ones)
+
+  int acquire() {
+    std::lock_guard<std::mutex> g(mtx);
+    if (free_ids.empty()) return num_ids++;
+    int id = free_ids.back();
+    free_ids.pop_back();
+    return id;
+  }
+
+  void release(int id) {
+    std::lock_guard<std::mutex> g(mtx);
+    free_ids.push_back(id);
+  }
+};
+
+  // never destructed, since threads can exit after static destructors
+  inline worker_id_pool& get_worker_id_pool() {
+    static worker_id_pool* pool = new worker_id_pool;
+    return *pool;
+  }
+
+  // owned by each thread, releases its id when the thread exits
+  struct worker_id_owner {
+    int id = -1;
+    ~worker_id_owner() { if (id >= 0) get_worker_id_pool().release(id);}
+  };
+
+  // inline so that a thread has one id across translation units
+  inline thread_local worker_id_owner my_worker_id;
+
+  inline int register_worker() {
+    if (my_worker_id.id < 0) my_worker_id.id = get_worker_id_pool().acquire();
+    return my_worker_id.id;
+  }
+
+  inline void deregister_worker() {
+    if (my_worker_id.id < 0) return;
+    get_worker_id_pool().release(my_worker_id.id);
+    my_worker_id.id = -1;
+  }
+
+  inline int worker_id() {
+    int id = my_worker_id.id;
+    return (id >= 0) ? id : register_worker();
+  }
+
+  // upper bound on ids in use
+  inline int max_worker_id() {
+    return get_worker_id_pool().num_ids.load();
+  }
+
+// A growable array with one T per worker id.  The first chunk has
+// num_workers() slots and each further chunk doubles the total, so an
+// element never moves and lookups for the first num_workers() ids are
+// a single test.  Slots are default constructed.
+template <typename T>
+struct per_worker {
+private:
+  static constexpr int max_chunks = 40;
+  size_t first_size;
+  std::atomic<T*> chunks[max_chunks];
+  std::mutex mtx;
+
+  static int log2_floor(size_t x) { return 63 - __builtin_clzl(x);}
+
+  // chunk k > 0 starts at first_size * 2^(k-1) and has that many slots
+  size_t chunk_start(int k) const {return k == 0 ? 0 : first_size << (k-1);}
+  size_t chunk_size(int k) const {return k == 0 ? first_size : first_size << (k-1);}
+
+  T* get_chunk(int k) {
+    T* c = chunks[k].load();
+    if (c != nullptr) return c;
+    std::lock_guard<std::mutex> g(mtx);
+    c = chunks[k].load();
+    if (c == nullptr) {
+      c = new T[chunk_size(k)];
+      chunks[k] = c;
+    }
+    return c;
+  }
+
+public:
+  per_worker() : first_size(std::max(1, num_workers())) {
+    for (auto& c : chunks) c = nullptr;
+    chunks[0] = new T[first_size];
+  }
+  per_worker(const per_worker&) = delete;
+  ~per_worker() { for (auto& c : chunks) delete[] c.load();}
+
+  T& operator[](size_t i) {
+    if (i < first_size) return chunks[0].load(std::memory_order_relaxed)[i];
+    int k = log2_floor(i / first_size) + 1;
+    return get_chunk(k)[i - chunk_start(k)];
+  }
+
+  // number of slots allocated so far
+  size_t size() const {
+    size_t n = 0;
+    for (int k = 0; k < max_chunks && chunks[k].load() != nullptr; k++)
+      n = chunk_start(k) + chunk_size(k);
+    return n;
+  }
+
+  // applies f to every allocated slot
+  template <typename F>
+  void for_each(F f) {
+    for (int k = 0; k < max_chunks; k++) {
+      T* c = chunks[k].load();
+      if (c == nullptr) break;
+      for (size_t i = 0; i < chunk_size(k); i++) f(c[i]);
+    }
+  }
+};
+
 struct alignas(64) epoch_s {
         
   // functions to run when epoch is incremented
@@ -66,23 +197,40 @@ struct alignas(64) epoch_s {
     announce_slot() : last(-1l) {}
   };
 
-  std::vector<announce_slot> announcements;
+  per_worker<announce_slot> announcements;
   std::atomic<long> current_epoch;
+
+  // Pins hold back the epoch like an announcement but are not tied to
+  // a thread, so they can be held across operations (e.g. by a
+  // cursor).  Retired memory is not reclaimed while any pin is held.
+  std::mutex pin_mtx;
+  std::vector<long> pins;
+  std::atomic<int> num_pins = 0;
   epoch_s() {
-    int workers = num_workers();
-    announcements = std::vector<announce_slot>(workers);
     current_epoch = 0;
   }
 
   void print_announce() {
-    for(auto& ann : announcements)
-      std::cout << ann.last << " ";
+    announcements.for_each([] (announce_slot& ann) {
+      std::cout << ann.last << " ";});
     std::cout << std::endl;
   }
 
+  // for each worker, how many epochs it is behind the current one,
+  // or -1 if it is not in an epoch
+  std::vector<long> epoch_lag() {
+    long current_e = get_current();
+    std::vector<long> lag;
+    int n = max_worker_id();
+    for (int i = 0; i < n; i++) {
+      long e = announcements[i].last.load(std::memory_order_relaxed);
+      lag.push_back(e == -1l ? -1l : std::max(0l, current_e - e));
+    }
+    return lag;
+  }
+
   void clear_announce() {
-    for(auto& ann : announcements)
-      ann.last = -1;
+    announcements.for_each([] (announce_slot& ann) {ann.last = -1;});
   }
 
   long get_current() {
@@ -117,22 +265,44 @@ struct alignas(64) epoch_s {
     }
   }
 
+  // Pins the epoch the caller is in.  Must be called inside an epoch
+  // so the epoch cannot advance past the pinned one in between.
+  long pin() {
+    long e = get_my_epoch();
+    assert(e != -1l);
+    std::lock_guard<std::mutex> g(pin_mtx);
+    pins.push_back(e);
+    num_pins++;
+    return e;
+  }
+
+  void unpin(long e) {
+    std::lock_guard<std::mutex> g(pin_mtx);
+    pins.erase(std::find(pins.begin(), pins.end(), e));
+    num_pins--;
+  }
+
   void unannounce(size_t id) {
     assert(announcements[id].last.load() != -1l);
     announcements[id].last.store(-1l, std::memory_order_release);
   }
 
   void update_epoch() {
-    size_t id = worker_id();
-    int workers = num_workers();
     long current_e = get_current();
     bool all_there = true;
     // check if everyone is done with earlier epochs
+    // (slots past max_worker_id() have never been used)
+    int workers = max_worker_id();
     for (int i=0; i < workers; i++)
       if ((announcements[i].last != -1l) && announcements[i].last < current_e) {
         all_there = false;
         break;
       }
+    if (all_there && num_pins.load() > 0) {
+      std::lock_guard<std::mutex> g(pin_mtx);
+      for (long e : pins)
+        if (e < current_e) all_there = false;
+    }
     // if so then increment current epoch
     if (all_there) {
       for (auto h : before_epoch_hooks) h();
@@ -149,6 +319,54 @@ struct alignas(64) epoch_s {
     return epoch;
   }
 
+// ***************************
+// pool metrics
+// ***************************
+
+// counts for a single pool (i.e. a single type)
+struct pool_metrics {
+  std::string type_name;
+  size_t object_size;   // bytes per object, including any padding
+  long live;            // allocated and not yet freed (includes retired)
+  long retired;         // retired but not yet reclaimed
+  size_t live_bytes;
+  size_t retired_bytes;
+  size_t allocator_bytes; // bytes held by the block allocator for this size
+};
+
+// Every mem_pool registers itself on construction so that metrics()
+// can find it.  The mutex is only taken when registering and reading,
+// never by the operations on the pools.
+struct pool_registry {
+  using entry = std::pair<const void*, std::function<pool_metrics()>>;
+  std::mutex mtx;
+  std::vector<entry> pools;
+
+  void add(const void* pool, std::function<pool_metrics()> f) {
+    std::lock_guard<std::mutex> g(mtx);
+    pools.push_back(entry(pool, std::move(f)));
+  }
+
+  void remove(const void* pool) {
+    std::lock_guard<std::mutex> g(mtx);
+    pools.erase(std::remove_if(pools.begin(), pools.end(),
+                               [&] (entry& e) {return e.first == pool;}),
+                pools.end());
+  }
+
+  std::vector<pool_metrics> collect() {
+    std::lock_guard<std::mutex> g(mtx);
+    std::vector<pool_metrics> result;
+    for (auto& e : pools) result.push_back(e.second());
+    return result;
+  }
+};
+
+  extern inline pool_registry& get_pool_registry() {
+    static pool_registry registry;
+    return registry;
+  }
+
 // ***************************
 // epoch pools
 // ***************************
@@ -189,9 +407,21 @@ private:
     long epoch; // epoch on last retire, updated on a retire
     long count; // number of retires so far, reset on updating the epoch
     sys_time time; // time of last epoch update
-    old_current() : old(nullptr), current(nullptr), epoch(0) {}
+    // metrics, only written by the owning worker so relaxed is enough
+    std::atomic<long> allocated; // objects allocated
+    std::atomic<long> freed;     // objects destructed and freed
+    std::atomic<long> retired;   // objects retired
+    std::atomic<long> reclaimed; // retired objects taken off the lists
+    old_current() : old(nullptr), current(nullptr), epoch(0), count(0),
+                    time(system_clock::now()),
+                    allocated(0), freed(0), retired(0), reclaimed(0) {}
   };
 
+  static void increment(std::atomic<long>& counter, long n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+
   // only used for debugging (i.e. EpochMemCheck=1).
   struct paddedT {
     long pad;
@@ -200,13 +430,14 @@ private:
     std::atomic<long> tail;
   };
 
-  std::vector<old_current> pools;
+  per_worker<old_current> pools;
   int workers;
 
   bool* add_to_current_list(void* p) {
     auto i = worker_id();
     auto &pid = pools[i];
     advance_epoch(i, pid);
+    increment(pid.retired);
     Link* lnk = allocate_link();
     lnk->next = pid.current;
     lnk->value = p;
@@ -218,7 +449,9 @@ private:
   // destructs and frees a linked list of objects 
   void clear_list(Link* ptr) {
     // abort();
+    long n = 0;
     while (ptr != nullptr) {
+      n++;
       Link* tmp = ptr;
       ptr = ptr->next;
       if (!tmp->skip) {
@@ -235,6 +468,7 @@ private:
       }
       free_link(tmp);
     }
+    if (n > 0) increment(pools[worker_id()].reclaimed, n);
   }
 
   // computes size of list
@@ -288,15 +522,13 @@ public:
   mem_pool() {
     workers = num_workers();
     update_threshold = 10 * workers;
-    pools = std::vector<old_current>(workers);
-    for (int i = 0; i < workers; i++) {
+    for (int i = 0; i < workers; i++)
       pools[i].count = parlay::hash64(i) % update_threshold;
-      pools[i].time = system_clock::now();
-    }
+    get_pool_registry().add(this, [this] {return metrics();});
   }
 
   mem_pool(const mem_pool&) = delete;
-  ~mem_pool() {} // clear(); }
+  ~mem_pool() { get_pool_registry().remove(this);} // clear(); }
 
   // noop since epoch announce is used for the whole operation
   void acquire(T* p) { }
@@ -308,6 +540,7 @@ public:
   
   // destructs and frees the object immediately
   void destruct(T* p) {
+     increment(pools[worker_id()].freed);
      p->~T();
 #ifdef EpochMemCheck
      paddedT* x = pad_from_T(p);
@@ -320,6 +553,7 @@ public:
 
   template <typename ... Args>
   T* new_obj(Args... args) {
+    increment(pools[worker_id()].allocated);
 #ifdef EpochMemCheck
     paddedT* x = allocate_node();
     x->pad = x->head = x->tail = 10;
@@ -360,11 +594,11 @@ public:
   // to be used on termination
   void clear() {
     get_epoch().update_epoch();
-    for (int i=0; i < pools.size(); i++) {
-      clear_list(pools[i].old);
-      clear_list(pools[i].current);
-      pools[i].old = pools[i].current = nullptr;
-    }
+    pools.for_each([&] (old_current& pid) {
+      clear_list(pid.old);
+      clear_list(pid.current);
+      pid.old = pid.current = nullptr;
+    });
   }
 
   void reserve(size_t n) {
@@ -377,14 +611,39 @@ public:
     get_epoch().print_announce();
     // get_epoch().clear_announce();
     std::cout << "epoch number: " << get_epoch().get_current() << std::endl;
-    for (int i=0; i < pools.size(); i++) {
-      std::cout << "pool[" << i << "] = " << size_of(pools[i].old) << ", " << size_of(pools[i].current) << std::endl;
-    }
+    int i = 0;
+    pools.for_each([&] (old_current& pid) {
+      std::cout << "pool[" << i++ << "] = " << size_of(pid.old) << ", " << size_of(pid.current) << std::endl;
+    });
 #ifndef USE_MALLOC
     Allocator::print_stats();
 #endif
   }
 
+  // Sums the per-worker counters.  Does not walk the retired lists.
+  pool_metrics metrics() {
+    long allocated = 0, freed = 0, retired = 0, reclaimed = 0;
+    pools.for_each([&] (old_current& pid) {
+      allocated += pid.allocated.load(std::memory_order_relaxed);
+      freed += pid.freed.load(std::memory_order_relaxed);
+      retired += pid.retired.load(std::memory_order_relaxed);
+      reclaimed += pid.reclaimed.load(std::memory_order_relaxed);
+    });
+    pool_metrics m;
+    m.type_name = typeid(T).name();
+    m.object_size = sizeof(nodeT);
+    m.live = std::max(0l, allocated - freed);
+    m.retired = std::max(0l, retired - reclaimed);
+    m.live_bytes = m.live * sizeof(nodeT);
+    m.retired_bytes = m.retired * sizeof(nodeT);
+#ifdef USE_MALLOC
+    m.allocator_bytes = m.live_bytes;
+#else
+    m.allocator_bytes = Allocator::num_allocated_blocks() * Allocator::block_size();
+#endif
+    return m;
+  }
+
   void shuffle(size_t n) {}
     
 };
@@ -417,6 +676,27 @@ auto with_epoch(Thunk f) {
   }
 }
 
+struct metrics_snapshot {
+  long epoch;                     // current epoch number
+  std::vector<long> epoch_lag;    // per worker, -1 if not in an epoch
+  std::vector<internal::pool_metrics> pools;
+  size_t allocator_used;          // from parlay::internal::memory_usage()
+  size_t allocator_reserve;
+};
+
+// Non-blocking (with respect to the pools) view of memory and epoch state.
+inline metrics_snapshot metrics() {
+  auto& epoch = internal::get_epoch();
+  metrics_snapshot m;
+  m.epoch = epoch.get_current();
+  m.epoch_lag = epoch.epoch_lag();
+  m.pools = internal::get_pool_registry().collect();
+  auto [used, reserve] = parlay::internal::memory_usage();
+  m.allocator_used = used;
+  m.allocator_reserve = reserve;
+  return m;
+}
+
   template <typename T>
   struct memory_pool_ {
     template <typename ... Args>
@@ -162,4 +162,18 @@ std::vector<internal::lock> lock::locks{1ul << bucket_bits};
   template <typename T>
   inline void pool_stats() {get_pool<T>().stats();}
 
+  // Threads get a worker id (used to index announcements and per-thread
+  // pools) on first use, and give it back when they exit.  A thread can
+  // also do this explicitly, e.g. a long-lived thread that only
+  // occasionally uses the structures.  Ids are recycled.
+  // Must not be called inside with_epoch or while holding a lock.
+  inline int register_thread() { return internal::register_worker();}
+
+  inline void deregister_thread() {
+    if (internal::my_worker_id.id < 0) return;
+    assert(internal::get_epoch().get_my_epoch() == -1l);
+    internal::current_id = 1000000;
+    internal::deregister_worker();
+  }
+
 } // namespace flck
@@ -24,26 +24,24 @@ namespace flck {
     
 // The announcement array with one announcement per thread
 struct write_annoucements {
-  std::atomic<size_t>* announcements;
-  const int stride = {16};
-  write_annoucements() {
-    announcements = new std::atomic<size_t>[flck::internal::num_workers()*stride];
-  }
-  ~write_annoucements() {
-    delete[] announcements;
-  }
+  struct alignas(128) slot {
+    std::atomic<size_t> announcement;
+    slot() : announcement(0) {}
+  };
+  per_worker<slot> announcements;
   std::vector<size_t> scan() {
     std::vector<size_t> announced_tags;
-    for(int i = 0; i < flck::internal::num_workers()*stride; i += stride)
-      announced_tags.push_back(announcements[i]);
+    int n = flck::internal::max_worker_id();
+    for(int i = 0; i < n; i++)
+      announced_tags.push_back(announcements[i].announcement);
     return announced_tags;
   }
   void set(size_t val) {
     int id = flck::internal::worker_id();
-    announcements[id*stride] = val;}
+    announcements[id].announcement = val;}
   void clear() {
     int id = flck::internal::worker_id();
-    announcements[id*stride].store(0, std::memory_order::memory_order_release);}
+    announcements[id].announcement.store(0, std::memory_order::memory_order_release);}
 };
 
 write_annoucements announce_write = {};
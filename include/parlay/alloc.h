@@ -273,7 +273,8 @@ public:
   static void retire(T* ptr) { destroy(ptr); }
   static void init(size_t, size_t) {};
   static void init() {};
-  static void reserve([[maybe_unused]] size_t n = default_alloc_size) { }
+  // Pre-allocates (and faults in) space for n objects
+  static void reserve(size_t n = default_alloc_size) { if (n > 0) get_allocator().reserve(n); }
   static void finish() { get_allocator().clear(); }
   static size_t block_size () { return get_allocator().get_block_size(); }
   static size_t num_allocated_blocks() { return get_allocator().num_allocated_blocks(); }
@@ -7,6 +7,16 @@
 // Keeps track of number of allocated elements. Much more efficient
 // than a general purpose allocator.
 //
+// On machines with more than one NUMA node the global pool is split
+// into one stack per node.  Lists are returned to (and taken from) the
+// stack of the node the calling thread is running on, and new lists are
+// placed on that node, so blocks tend to be reused on the socket that
+// last touched them.  Other nodes are only raided before allocating
+// fresh memory.
+//
+// If huge pages are enabled (see huge_pages.h) buffers are mmapped in
+// multiples of the huge page size and carved into lists.
+//
 // Not generally intended for users. Users should use "type_allocator"
 // which is a convenient wrapper around block_allocator that helps
 // to manage memory for a specific type
@@ -20,6 +30,7 @@
 #include <algorithm>
 #include <atomic>
 #include <iostream>
+#include <memory>
 #include <new>
 #include <optional>
 
@@ -29,6 +40,8 @@
 #include "concurrency/hazptr_stack.h"
 
 #include "memory_size.h"
+#include "numa.h"
+#include "huge_pages.h"
 
 // IWYU pragma: no_include <array>
 // IWYU pragma: no_include <vector>
@@ -53,8 +66,15 @@ struct block_allocator {
     local_list() : sz(0), head(nullptr), mid(nullptr) {};
   };
 
-  hazptr_stack<std::byte*> allocated_buffers;
-  hazptr_stack<block*> global_stack;
+  struct buffer_info {
+    std::byte* ptr;
+    size_t bytes;
+    bool mapped;  // from huge_alloc rather than ::operator new
+  };
+
+  hazptr_stack<buffer_info> allocated_buffers;
+  size_t num_nodes;
+  std::unique_ptr<hazptr_stack<block*>[]> global_stacks;  // one per NUMA node
   ThreadSpecific<local_list> my_local_list;
 
   size_t block_size;
@@ -90,41 +110,72 @@ struct block_allocator {
   }
 
   size_t num_used_blocks() {
-    size_t free_blocks = global_stack.size()*list_length;
+    size_t free_blocks = 0;
+    for (size_t i = 0; i < num_nodes; i++)
+      free_blocks += global_stacks[i].size()*list_length;
     my_local_list.for_each([&](auto&& list) {
       free_blocks += list.sz;
     });
     return blocks_allocated.load() - free_blocks;
   }
 
-  auto allocate_blocks(size_t num_blocks) -> std::byte* {
-    auto buffer = static_cast<std::byte*>(::operator new(num_blocks * block_size, block_align));
+  // Allocates a buffer holding at least num_lists lists on the given
+  // node (more if rounded up to a huge page), and initializes them,
+  // which also faults in the pages.  All but the first list are pushed
+  // on the node's global stack, and the first is returned.
+  // With huge pages, a refill maps a whole page, so the rest of the
+  // page serves later refills.  With 1GB pages, refills smaller than
+  // that use 2MB pages, so that each type does not take a 1GB page.
+  auto allocate_lists(size_t num_lists, size_t node, bool reserving = false) -> block* {
+    size_t list_bytes = list_length * block_size;
+    size_t bytes = num_lists * list_bytes;
+    huge_page_mode mode = get_huge_page_mode();
+    std::byte* buffer = nullptr;
+    if (mode != huge_page_mode::none) {
+      if (!reserving && mode == huge_page_mode::huge_1gb &&
+          bytes < huge_page_bytes(mode))
+        mode = huge_page_mode::huge_2mb;
+      buffer = static_cast<std::byte*>(huge_alloc(bytes, mode));
+    }
+    bool mapped = (buffer != nullptr);
+    if (!mapped) {
+      bytes = num_lists * list_bytes;
+      buffer = static_cast<std::byte*>(::operator new(bytes, block_align));
+    }
     assert(buffer != nullptr);
+    if (num_nodes > 1) numa_bind(buffer, bytes, node);
+    num_lists = bytes / list_bytes;
 
-    blocks_allocated.fetch_add(num_blocks);
+    blocks_allocated.fetch_add(num_lists * list_length);
     assert(blocks_allocated.load() <= max_blocks);
 
-    allocated_buffers.push(buffer); // keep track so can free later
-    return buffer;
+    allocated_buffers.push(buffer_info{buffer, bytes, mapped}); // keep track so can free later
+    for (size_t i = 1; i < num_lists; i++)
+      global_stacks[node].push(initialize_list(buffer + i * list_bytes));
+    return initialize_list(buffer);
   }
 
-  // Either grab a list from the global pool, or if there is none
-  // then allocate a new list
+  size_t my_node() const {
+    return (num_nodes == 1) ? 0 : numa_current_node();
+  }
+
+  // Either grab a list from the global pool of my node, then from
+  // another node, or if there is none then allocate a new list
   auto get_list() -> block* {
-    std::optional<block*> rem = global_stack.pop();
-    if (rem) return *rem;
-    std::byte* buffer = allocate_blocks(list_length);
-    return initialize_list(buffer);
+    size_t node = my_node();
+    for (size_t i = 0; i < num_nodes; i++) {
+      std::optional<block*> rem = global_stacks[(node + i) % num_nodes].pop();
+      if (rem) return *rem;
+    }
+    return allocate_lists(1, node);
   }
 
   // Allocate n elements across however many lists are needed (rounded up)
+  // spread evenly across the NUMA nodes.  The memory is faulted in.
   void reserve(size_t n) {
-    size_t num_lists = 256 + (n + list_length - 1) / list_length;
-    std::byte* start = allocate_blocks(list_length*num_lists);
-    for(int i = 0; i < num_lists; i++) {
-      auto offset = reinterpret_cast<std::byte*>(start + i * list_length * get_block_size());
-      global_stack.push(initialize_list(offset));
-    }
+    size_t num_lists = (256 + (n + list_length - 1) / list_length + num_nodes - 1) / num_nodes;
+    for (size_t node = 0; node < num_nodes; node++)
+      global_stacks[node].push(allocate_lists(num_lists, node, true));
   }
 
   void print_stats() {
@@ -141,6 +192,8 @@ struct block_allocator {
     [[maybe_unused]] size_t reserved_blocks = 0,
     size_t list_length_ = 0,
     size_t max_blocks_ = 0) :
+      num_nodes(numa_num_nodes()),
+      global_stacks(new hazptr_stack<block*>[num_nodes]),
       my_local_list(),                                                               // Each block needs to be at least
       block_size(std::max<size_t>(block_size_, sizeof(block))),    // <------------- // large enough to hold the struct
       block_align(std::align_val_t{std::max<size_t>(block_align_, min_alignment)}),  // representing a free block.
@@ -171,9 +224,13 @@ struct block_allocator {
       });
 
       // throw away all allocated memory
-      std::optional<std::byte*> x;
-      while ((x = allocated_buffers.pop())) ::operator delete(*x, block_align);
-      global_stack.clear();
+      std::optional<buffer_info> x;
+      while ((x = allocated_buffers.pop())) {
+        if (x->mapped) huge_free(x->ptr, x->bytes);
+        else ::operator delete(x->ptr, block_align);
+      }
+      for (size_t i = 0; i < num_nodes; i++)
+        global_stacks[i].clear();
       blocks_allocated.store(0);
       return true;
     }
@@ -194,7 +251,7 @@ struct block_allocator {
     if (my_local_list->sz == list_length+1) {
       my_local_list->mid = my_local_list->head;
     } else if (my_local_list->sz == 2*list_length) {
-      global_stack.push(my_local_list->mid->next);
+      global_stacks[my_node()].push(my_local_list->mid->next);
       my_local_list->mid->next = nullptr;
       my_local_list->sz = list_length;
     }
@@ -221,7 +278,7 @@ struct block_allocator {
         // Looks like the task got stolen and the new thread already had a
         // non-empty local list, so we can push the new one into the global
         // pool for someone else to use in the future
-        global_stack.push(new_list);
+        global_stacks[my_node()].push(new_list);
       }
     }
 
@@ -0,0 +1,108 @@
+// Optional huge-page backing for the block allocator.
+//
+// The mode is taken from the environment variable PARLAY_HUGE_PAGES
+// ("thp", "2m" or "1g", anything else means off) and can be changed
+// at runtime with set_huge_page_mode().  It only affects memory
+// allocated after the change.
+//
+//   none        : ::operator new, as before
+//   transparent : anonymous mmap aligned to 2MB with madvise(MADV_HUGEPAGE)
+//   huge_2mb    : mmap(MAP_HUGETLB | 2MB), falls back to transparent
+//   huge_1gb    : mmap(MAP_HUGETLB | 1GB), falls back to huge_2mb
+//
+// Explicit huge pages need pages reserved by the administrator
+// (e.g. /proc/sys/vm/nr_hugepages), hence the fallbacks.
+
+#ifndef PARLAY_INTERNAL_HUGE_PAGES_H_
+#define PARLAY_INTERNAL_HUGE_PAGES_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+#include <string>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace parlay {
+namespace internal {
+
+enum class huge_page_mode { none, transparent, huge_2mb, huge_1gb };
+
+inline huge_page_mode huge_page_mode_from_string(const std::string& s) {
+  if (s == "thp" || s == "transparent") return huge_page_mode::transparent;
+  if (s == "2m" || s == "2M") return huge_page_mode::huge_2mb;
+  if (s == "1g" || s == "1G") return huge_page_mode::huge_1gb;
+  return huge_page_mode::none;
+}
+
+inline std::atomic<huge_page_mode>& huge_page_mode_ref() {
+  static std::atomic<huge_page_mode> mode(
+      huge_page_mode_from_string(std::getenv("PARLAY_HUGE_PAGES") ?
+                                 std::getenv("PARLAY_HUGE_PAGES") : ""));
+  return mode;
+}
+
+inline huge_page_mode get_huge_page_mode() { return huge_page_mode_ref().load(); }
+inline void set_huge_page_mode(huge_page_mode m) { huge_page_mode_ref() = m; }
+
+inline constexpr size_t huge_page_bytes(huge_page_mode m) {
+  return (m == huge_page_mode::huge_1gb) ? (size_t{1} << 30)
+       : (m == huge_page_mode::none) ? 0 : (size_t{1} << 21);
+}
+
+// Allocates at least bytes of huge-page backed memory, and sets bytes
+// to the length actually mapped.  Returns nullptr if the mode is none
+// or nothing works, in which case the caller should use its normal
+// allocator.  The memory is zeroed and not yet faulted in.
+inline void* huge_alloc([[maybe_unused]] size_t& bytes, [[maybe_unused]] huge_page_mode m) {
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+  if (m == huge_page_mode::none) return nullptr;
+  const int prot = PROT_READ | PROT_WRITE;
+  const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+  if (m == huge_page_mode::huge_1gb || m == huge_page_mode::huge_2mb) {
+    int shift = (m == huge_page_mode::huge_1gb) ? 30 : 21;
+    size_t page = size_t{1} << shift;
+    size_t len = (bytes + page - 1) & ~(page - 1);
+    void* p = mmap(nullptr, len, prot, flags | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+    if (p != MAP_FAILED) {
+      bytes = len;
+      return p;
+    }
+    if (m == huge_page_mode::huge_1gb) return huge_alloc(bytes, huge_page_mode::huge_2mb);
+  }
+#endif
+  // transparent huge pages: over-map so the range can be 2MB aligned,
+  // then trim both ends
+  const size_t page = size_t{1} << 21;
+  size_t len = (bytes + page - 1) & ~(page - 1);
+  void* raw = mmap(nullptr, len + page, prot, flags, -1, 0);
+  if (raw == MAP_FAILED) return nullptr;
+  uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+  uintptr_t aligned = (start + page - 1) & ~(page - 1);
+  if (aligned > start) munmap(raw, aligned - start);
+  munmap(reinterpret_cast<void*>(aligned + len), start + page - aligned);
+#if defined(MADV_HUGEPAGE)
+  madvise(reinterpret_cast<void*>(aligned), len, MADV_HUGEPAGE);
+#endif
+  bytes = len;
+  return reinterpret_cast<void*>(aligned);
+#else
+  return nullptr;
+#endif
+}
+
+// Frees memory from huge_alloc, bytes as returned by huge_alloc
+inline void huge_free([[maybe_unused]] void* p, [[maybe_unused]] size_t bytes) {
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+  munmap(p, bytes);
+#endif
+}
+
+}  // namespace internal
+}  // namespace parlay
+
+#endif  // PARLAY_INTERNAL_HUGE_PAGES_H_
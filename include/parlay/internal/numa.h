@@ -0,0 +1,87 @@
+// Minimal NUMA support used by the block allocator.
+//
+// numa_num_nodes() -> size_t       : number of NUMA nodes (1 if unknown)
+// numa_current_node() -> size_t    : node of the cpu the caller runs on
+// numa_bind(ptr, bytes, node)      : ask the kernel to place the (not yet
+//                                    touched) pages of the range on node
+//
+// Only uses raw system calls on Linux (no libnuma), and degrades to a
+// single node everywhere else.  Setting the environment variable
+// PARLAY_NUMA=0 also forces a single node.
+
+#ifndef PARLAY_INTERNAL_NUMA_H_
+#define PARLAY_INTERNAL_NUMA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace parlay {
+namespace internal {
+
+inline size_t numa_detect_nodes() {
+#if defined(__linux__) && defined(SYS_getcpu) && defined(SYS_mbind)
+  if (const char* env = std::getenv("PARLAY_NUMA"))
+    if (std::string(env) == "0") return 1;
+  // "possible" is a range list such as "0" or "0-3"
+  std::ifstream f("/sys/devices/system/node/possible");
+  std::string s;
+  if (!(f >> s) || s.empty()) return 1;
+  size_t pos = s.find_last_of("-,");
+  std::string last = (pos == std::string::npos) ? s : s.substr(pos + 1);
+  size_t n = std::strtoul(last.c_str(), nullptr, 10) + 1;
+  return (n > 0 && n <= 1024) ? n : 1;
+#else
+  return 1;
+#endif
+}
+
+inline size_t numa_num_nodes() {
+  static const size_t num_nodes = numa_detect_nodes();
+  return num_nodes;
+}
+
+inline size_t numa_current_node() {
+#if defined(__linux__) && defined(SYS_getcpu)
+  if (numa_num_nodes() == 1) return 0;
+  unsigned cpu = 0, node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return 0;
+  return node < numa_num_nodes() ? node : 0;
+#else
+  return 0;
+#endif
+}
+
+// Sets a preferred (not strict) policy so allocation falls back to
+// other nodes if the node runs out of memory.  Only whole pages inside
+// the range are affected.  Returns false if nothing was done.
+inline bool numa_bind([[maybe_unused]] void* ptr, [[maybe_unused]] size_t bytes,
+                      [[maybe_unused]] size_t node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  if (numa_num_nodes() == 1) return false;
+  const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  uintptr_t start = (reinterpret_cast<uintptr_t>(ptr) + page - 1) & ~(page - 1);
+  uintptr_t end = (reinterpret_cast<uintptr_t>(ptr) + bytes) & ~(page - 1);
+  if (end <= start) return false;
+  constexpr int mpol_preferred = 1;
+  constexpr size_t bits = 8 * sizeof(unsigned long);
+  unsigned long mask[1024 / bits] = {};
+  mask[node / bits] |= 1ul << (node % bits);
+  return syscall(SYS_mbind, start, end - start, mpol_preferred,
+                 mask, numa_num_nodes() + 1, 0) == 0;
+#else
+  return false;
+#endif
+}
+
+}  // namespace internal
+}  // namespace parlay
+
+#endif  // PARLAY_INTERNAL_NUMA_H_
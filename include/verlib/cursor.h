@@ -0,0 +1,90 @@
+#pragma once
+#include <optional>
+#include "verlib.h"
+
+// A resumable scan over an ordered map in a fixed snapshot.
+// Construction takes a snapshot stamp and pins the current epoch so
+// the versions the snapshot needs are not reclaimed.  next_batch(n)
+// then returns the next (up to) n key-values in key order, each call
+// in its own short epoch, so a long export does not hold one epoch
+// (or one thread) for its whole duration.  Calls can come from
+// different threads but not concurrently.
+// Memory retired while the cursor is open is not reclaimed until it is
+// destroyed (or closed), so cursors should not be left open.
+// A descending cursor returns keys not greater than start, largest
+// first.
+// The Map needs range_limit_(start, n) and range_desc_limit_(start, n),
+// as in btree, arttree and blockleaftree.
+// Without Versioned the batches are not from a single snapshot.
+
+namespace verlib {
+
+template <typename Map, typename K, typename V>
+struct cursor {
+  Map* m;
+  std::optional<K> last;  // last key returned
+  K start;
+  long pinned = -1;
+  bool descending;
+  bool done = false;
+#ifdef Versioned
+  TS stamp;
+#endif
+
+  cursor(Map& map, const K& start, bool descending = false)
+    : m(&map), start(start), descending(descending) {
+    with_epoch([&] {
+      pinned = flck::internal::get_epoch().pin();
+#ifdef Versioned
+      stamp = non_speculative_read_stamp();
+#endif
+      return true;});
+  }
+
+  cursor(const cursor&) = delete;
+  cursor& operator=(const cursor&) = delete;
+  cursor(cursor&& c) : m(c.m), last(c.last), start(c.start),
+                       pinned(c.pinned), descending(c.descending),
+                       done(c.done) {
+#ifdef Versioned
+    stamp = c.stamp;
+#endif
+    c.pinned = -1;
+  }
+
+  // releases the pinned epoch, after which next_batch returns nothing
+  void close() {
+    if (pinned != -1) flck::internal::get_epoch().unpin(pinned);
+    pinned = -1;
+    done = true;
+  }
+
+  ~cursor() {close();}
+
+  // The next (up to) n key-values after (or before if descending)
+  // those already returned.  An empty result means the scan is finished.
+  parlay::sequence<std::pair<K,V>> next_batch(size_t n) {
+    if (done || n == 0) return {};
+    auto r = with_epoch([&] {
+#ifdef Versioned
+      local_stamp = stamp;
+#endif
+      // the last key is in the snapshot, so ask for one more and drop it
+      const K& from = last.has_value() ? *last : start;
+      size_t cnt = last.has_value() ? n + 1 : n;
+      auto r = descending ? m->range_desc_limit_(from, cnt)
+                          : m->range_limit_(from, cnt);
+#ifdef Versioned
+      local_stamp = -1;
+#endif
+      return r;});
+    if (last.has_value() && r.size() > 0 &&
+        (descending ? !(r[0].first < *last) : !(*last < r[0].first)))
+      r = parlay::to_sequence(r.cut(1, r.size()));
+    if (r.size() < n) done = true;
+    if (r.size() > 0) last = r[r.size()-1].first;
+    return r;
+  }
+};
+
+} // namespace verlib
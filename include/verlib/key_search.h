@@ -0,0 +1,170 @@
+#pragma once
+#include <type_traits>
+#include <functional>
+#include <cstring>
+#include <cstdint>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Vectorized search over the sorted keys of a btree node or leaf.
+//
+// count<K, OrEqual, Stride>(keys, n, k) returns the number of the first
+// n keys that are less than k (less or equal if OrEqual), where
+// consecutive keys are Stride bytes apart (sizeof(K) for the key array
+// of an internal node, sizeof(KV) for the interleaved key-values of a
+// leaf).  Since the keys are sorted this is the position of the first
+// key not less than (greater than) k, so there are no data dependent
+// branches.
+//
+// Vectorized for 8-byte integer keys compared with std::less and a
+// stride of 8 or 16, using AVX-512 if available, else AVX2.  Everything
+// else uses the scalar loop.
+//
+// match_byte(bytes, n, b) returns the position of b in the first n of
+// the 16 bytes at bytes (at most one can match), or -1.  Used for the
+// key bytes of arttree sparse nodes.  One SSE2 compare if available.
+//
+// match_bytes(bytes, n, b) returns a bit mask of the positions of b in
+// the first n (at most 64) bytes at bytes.  For n <= 8 it reads 8 bytes
+// and matches them as one word, otherwise it reads n rounded up to a
+// multiple of 16 with SSE2 if available.  Used for the tags of
+// hash_block nodes.
+
+namespace key_search {
+
+template <typename K, typename Compare, int Stride>
+constexpr bool vectorized =
+#if defined(__AVX2__) || defined(__AVX512F__)
+  std::is_integral_v<K> && sizeof(K) == 8 &&
+  (std::is_same_v<Compare, std::less<K>> || std::is_same_v<Compare, std::less<>>) &&
+  (Stride == 8 || Stride == 16);
+#else
+  false;
+#endif
+
+template <typename K, bool OrEqual, int Stride>
+inline int count_scalar(const K* keys, int n, const K& k) {
+  const char* p = (const char*) keys;
+  int i = 0;
+  if constexpr (OrEqual)
+    while (i < n && !(k < *((const K*) (p + i * Stride)))) i++;
+  else
+    while (i < n && *((const K*) (p + i * Stride)) < k) i++;
+  return i;
+}
+
+#if defined(__AVX512F__)
+
+template <typename K, bool OrEqual>
+inline __mmask8 compare(__m512i x, __m512i kv) {
+  if constexpr (std::is_signed_v<K>)
+    return OrEqual ? _mm512_cmple_epi64_mask(x, kv) : _mm512_cmplt_epi64_mask(x, kv);
+  else
+    return OrEqual ? _mm512_cmple_epu64_mask(x, kv) : _mm512_cmplt_epu64_mask(x, kv);
+}
+
+template <typename K, bool OrEqual, int Stride>
+inline int count(const K* keys, int n, const K& k) {
+  if constexpr (!vectorized<K, std::less<K>, Stride>)
+    return count_scalar<K, OrEqual, Stride>(keys, n, k);
+  else {
+    // keys per 64-byte vector, and which lanes hold keys
+    constexpr int per = 64 / Stride;
+    constexpr __mmask8 key_lanes = (Stride == 8) ? 0xff : 0x55;
+    const char* p = (const char*) keys;
+    __m512i kv = _mm512_set1_epi64((long long) k);
+    int cnt = 0;
+    int i = 0;
+    for (; i + per <= n; i += per) {
+      __m512i x = _mm512_loadu_si512((const void*) (p + i * Stride));
+      cnt += __builtin_popcount(compare<K, OrEqual>(x, kv) & key_lanes);
+    }
+    if (i < n) { // masked load of the remaining keys, does not fault
+      __mmask8 valid = (Stride == 8) ? (__mmask8) ((1u << (n - i)) - 1)
+                                     : (__mmask8) (key_lanes & ((1u << (2 * (n - i))) - 1));
+      __m512i x = _mm512_maskz_loadu_epi64(valid, (const void*) (p + i * Stride));
+      cnt += __builtin_popcount(compare<K, OrEqual>(x, kv) & valid);
+    }
+    return cnt;
+  }
+}
+
+#elif defined(__AVX2__)
+
+template <typename K, bool OrEqual, int Stride>
+inline int count(const K* keys, int n, const K& k) {
+  if constexpr (!vectorized<K, std::less<K>, Stride>)
+    return count_scalar<K, OrEqual, Stride>(keys, n, k);
+  else {
+    // AVX2 only has a signed compare, so flip the top bit of unsigned keys
+    const __m256i flip = _mm256_set1_epi64x(std::is_signed_v<K> ? 0 : (long long) (1ull << 63));
+    constexpr int per = 32 / Stride;
+    constexpr int key_lanes = (Stride == 8) ? 0xf : 0x5;
+    const char* p = (const char*) keys;
+    __m256i kv = _mm256_xor_si256(_mm256_set1_epi64x((long long) k), flip);
+    int cnt = 0;
+    int i = 0;
+    for (; i + per <= n; i += per) {
+      __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (p + i * Stride)), flip);
+      // x < k is k > x, and x <= k is !(x > k)
+      __m256i c = OrEqual ? _mm256_cmpgt_epi64(x, kv) : _mm256_cmpgt_epi64(kv, x);
+      int m = _mm256_movemask_pd(_mm256_castsi256_pd(c));
+      if constexpr (OrEqual) m = ~m;
+      cnt += __builtin_popcount(m & key_lanes);
+    }
+    return cnt + count_scalar<K, OrEqual, Stride>((const K*) (p + i * Stride), n - i, k);
+  }
+}
+
+#else
+
+template <typename K, bool OrEqual, int Stride>
+inline int count(const K* keys, int n, const K& k) {
+  return count_scalar<K, OrEqual, Stride>(keys, n, k);
+}
+
+#endif
+
+inline int match_byte(const unsigned char* bytes, int n, unsigned char b) {
+#if defined(__SSE2__)
+  __m128i x = _mm_loadu_si128((const __m128i*) bytes);
+  int m = _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8((char) b)));
+  m &= (1 << n) - 1;
+  return m ? __builtin_ctz(m) : -1;
+#else
+  for (int i = 0; i < n; i++)
+    if (bytes[i] == b) return i;
+  return -1;
+#endif
+}
+
+inline uint64_t match_bytes(const unsigned char* bytes, int n, unsigned char b) {
+  uint64_t m = 0;
+  if (n <= 8) {
+    uint64_t x;
+    std::memcpy(&x, bytes, 8);
+    x ^= 0x0101010101010101ull * b;
+    // high bit of each zero byte of x (no carries across bytes), then
+    // gathered into the low 8 bits
+    constexpr uint64_t low7 = 0x7f7f7f7f7f7f7f7full;
+    uint64_t z = ~(((x & low7) + low7) | x | low7);
+    m = ((z >> 7) * 0x0102040810204080ull) >> 56;
+  } else {
+#if defined(__SSE2__)
+    __m128i bv = _mm_set1_epi8((char) b);
+    for (int i = 0; i < n; i += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i*) (bytes + i));
+      m |= ((uint64_t) (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(x, bv))) << i;
+    }
+#else
+    for (int i = 0; i < n; i++)
+      if (bytes[i] == b) m |= 1ull << i;
+#endif
+  }
+  return (n < 64) ? m & ((1ull << n) - 1) : m;
+}
+
+} // namespace key_search
@@ -0,0 +1,66 @@
+#pragma once
+#include "verlib.h"
+
+// A versioned list of value overwrites for an otherwise immutable
+// block of values, such as a leaf of a tree.  Overwriting a value in
+// place is then a single versioned store of a small record rather than
+// a copy of the whole block.  Each record holds the index and new
+// value and points to the previous head, so the list seen by a
+// snapshot is exactly the overwrites that precede it.
+// Writers must hold whatever lock protects the block.  When the block
+// is copied the overwrites are folded into the copy and the list
+// should be retired along with the block.
+// The list ends in a shared empty record rather than a null pointer,
+// since recorded once pointers cannot be null.
+
+namespace verlib {
+
+template <typename V>
+struct overwrites {
+  struct rec : versioned {
+    int idx;
+    int count; // number of overwrites in the list starting here
+    V value;
+    rec* next;
+    rec(int idx, V value, rec* next)
+      : idx(idx), count(next == nullptr ? 0 : next->count + 1),
+        value(value), next(next) {}
+  };
+
+  versioned_ptr<rec> head;
+  static memory_pool<rec> pool;
+
+  static rec* empty() {
+    static rec e(-1, V(), nullptr);
+    return &e;
+  }
+
+  overwrites() : head(empty()) {}
+
+  // the current list, or the snapshot's list if in a snapshot
+  rec* load() {return head.load();}
+
+  static int size(rec* r) {return r->count;}
+
+  // the value at idx given the list r, and the original value v
+  static const V& get(rec* r, int idx, const V& v) {
+    for (; r->count > 0; r = r->next)
+      if (r->idx == idx) return r->value;
+    return v;
+  }
+
+  // r must be the current list (i.e. from load() under the lock)
+  void add(rec* r, int idx, const V& v) {
+    head = pool.new_obj(idx, v, r);
+  }
+
+  void retire() {
+    for (rec* r = head.load(); r->count > 0; r = r->next)
+      pool.retire(r);
+  }
+};
+
+template <typename V>
+memory_pool<typename overwrites<V>::rec> overwrites<V>::pool;
+
+} // namespace verlib
@@ -0,0 +1,36 @@
+#pragma once
+#include <atomic>
+#include "verlib.h"
+
+// A count of the entries in a structure, kept as one padded counter
+// per worker.  An update adds to its own worker's counter, so updates
+// do not contend, and get() sums the counters, taking time
+// proportional to the number of workers rather than to the size.
+// The count is exact when no updates are in progress, and otherwise
+// off by at most the number of updates in progress.
+// The counters are not versioned, so get() inside a snapshot returns
+// the current count rather than the snapshot's.
+
+namespace verlib {
+
+struct size_counter {
+  struct alignas(64) slot {std::atomic<long> n = 0;};
+  flck::internal::per_worker<slot> counts;
+
+  // only the worker itself writes its slot, so no atomic add is needed
+  void add(long delta) {
+    auto& c = counts[flck::internal::worker_id()].n;
+    c.store(c.load(std::memory_order_relaxed) + delta,
+	    std::memory_order_relaxed);
+  }
+  void increment() {add(1);}
+  void decrement() {add(-1);}
+
+  long get() {
+    long n = 0;
+    counts.for_each([&] (slot& c) {n += c.n.load(std::memory_order_relaxed);});
+    return n;
+  }
+};
+
+} // namespace verlib
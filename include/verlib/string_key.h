@@ -0,0 +1,62 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <ostream>
+
+// Immutable byte-string keys.  The bytes are stored once, out of line,
+// and shared by every copy of the key, so the copies held by the inner
+// nodes and leaves of a tree cost a pointer rather than a string.
+// Comparisons go through std::string_view, and order is by unsigned
+// bytes.
+//
+// string_key_traits is the String argument for arttree.  As for other
+// radix string keys a key ends with an implicit 0 byte, so keys should
+// not contain 0 bytes.
+
+namespace verlib {
+
+struct string_key {
+  std::shared_ptr<const std::string> s;
+
+  string_key() {}
+  string_key(std::string_view v) : s(std::make_shared<const std::string>(v)) {}
+  string_key(const char* c) : string_key(std::string_view(c)) {}
+  // from any contiguous range of chars, e.g. parlay::chars
+  template <typename Range,
+            typename = decltype(std::declval<const Range&>().data())>
+  string_key(const Range& r) : string_key(std::string_view(r.data(), r.size())) {}
+
+  std::string_view view() const {
+    return s ? std::string_view(*s) : std::string_view();}
+  size_t size() const {return s ? s->size() : 0;}
+  char operator[](size_t i) const {return (*s)[i];}
+
+  bool operator<(const string_key& b) const {return view() < b.view();}
+  bool operator>(const string_key& b) const {return view() > b.view();}
+  bool operator==(const string_key& b) const {
+    return s == b.s || view() == b.view();}
+  bool operator!=(const string_key& b) const {return !(*this == b);}
+};
+
+inline std::ostream& operator<<(std::ostream& os, const string_key& k) {
+  return os << k.view();}
+
+struct string_key_traits {
+  static int length(const string_key& k) {return k.size() + 1;}
+  static int get_byte(const string_key& k, int pos) {
+    std::string_view v = k.view();
+    return (pos >= (int) v.size()) ? 0 : (unsigned char) v[pos];}
+  static std::string_view view(const string_key& k) {return k.view();}
+};
+
+} // namespace verlib
+
+namespace std {
+template <>
+struct hash<verlib::string_key> {
+  size_t operator()(const verlib::string_key& k) const {
+    return std::hash<std::string_view>{}(k.view());}
+};
+}
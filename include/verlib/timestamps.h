@@ -410,6 +410,19 @@ auto with_snapshot_internal(F f) {
 
 thread_local bool aborted = false;
 
+// The stamp for a snapshot that is not speculative.  TL2 stamps have
+// no read stamp, so it is taken as a speculative snapshot does when
+// it retries after an abort.
+inline TS non_speculative_read_stamp() {
+#ifdef TL2Stamp
+  TS s = global_stamp.get_stamp();
+  global_stamp.increment_stamp(s);
+  return s;
+#else
+  return global_stamp.get_read_stamp();
+#endif
+}
+
 #ifndef LazyStamp
 template <typename F>
 auto with_snapshot(F f, bool unused_parameter=false) {
@@ -427,9 +440,14 @@ auto with_snapshot(F f, bool unused_parameter=false) {
 }
 #else
 thread_local bool speculative = false;
-parlay::sequence<long> num_retries(flck::internal::num_workers()*16, 0);
+struct alignas(128) retry_count {
+  long n = 0;
+};
+flck::internal::per_worker<retry_count> num_retries;
 void print_retries() {
-  std::cout << " retries = " << parlay::reduce(num_retries)
+  long total = 0;
+  num_retries.for_each([&] (retry_count& r) {total += r.n;});
+  std::cout << " retries = " << total
 	    << ", final stamp = " << global_stamp.get_read_stamp() <<std::endl;
 }
 
@@ -445,7 +463,7 @@ auto with_snapshot(F f, bool use_speculative=true) {
         speculative = false;
         if (aborted) {
           aborted = false;
-          num_retries[flck::internal::worker_id()*16]++;
+          num_retries[flck::internal::worker_id()].n++;
           global_stamp.increment_stamp(local_stamp);
           f();
         }
@@ -455,7 +473,7 @@ auto with_snapshot(F f, bool use_speculative=true) {
         speculative = false;
         if (aborted) {
           aborted = false;
-          num_retries[flck::internal::worker_id()*16]++;
+          num_retries[flck::internal::worker_id()].n++;
           global_stamp.increment_stamp(local_stamp);
           r = f();
         }
@@ -465,7 +483,7 @@ auto with_snapshot(F f, bool use_speculative=true) {
     });
   } else {
     return flck::with_epoch([&] {
-      local_stamp = global_stamp.get_read_stamp();
+      local_stamp = non_speculative_read_stamp();
       if constexpr (std::is_void_v<std::invoke_result_t<F>>) {
         f();
         local_stamp = -1;
@@ -52,4 +52,7 @@ namespace verlib {
 
 namespace verlib {
   using flck::with_epoch;
+  using flck::metrics;
+  using flck::register_thread;
+  using flck::deregister_thread;
 }
@@ -1,6 +1,6 @@
 import os
 
-ds_list = ['arttree_lf_versioned_hs', 'arttree_lf_indirect_hs', 'arttree_lf_noshortcut_hs', 'btree_lf_versioned_hs', 'btree_lf_indirect_hs', 'btree_lf_noshortcut_hs', 'hash_block_cas_versioned_hs', 'hash_block_cas_indirect_hs', 'hash_block_cas_noshortcut_hs', 'dlist_lf_versioned_hs', 'dlist_lf_indirect_hs', 'dlist_lf_noshortcut_hs', 'btree_lf_reconce_hs', 'hash_block_cas_versioned_ls', 'hash_block_cas_versioned_tl2s', 'hash_block_cas_versioned_ws', 'hash_block_cas_versioned_rs', 'btree_lck_versioned_hs', 'arttree_lck_versioned_hs', 'btree_lf_versioned_ls', 'btree_lf_versioned_rs']
+ds_list = ['arttree_lf_versioned_hs', 'arttree_lf_indirect_hs', 'arttree_lf_noshortcut_hs', 'btree_lf_versioned_hs', 'btree_lf_indirect_hs', 'btree_lf_noshortcut_hs', 'hash_block_cas_versioned_hs', 'hash_block_cas_indirect_hs', 'hash_block_cas_noshortcut_hs', 'dlist_lf_versioned_hs', 'dlist_lf_indirect_hs', 'dlist_lf_noshortcut_hs', 'btree_lf_reconce_hs', 'hash_block_cas_versioned_ls', 'hash_block_cas_versioned_tl2s', 'hash_block_cas_versioned_ws', 'hash_block_cas_versioned_rs', 'btree_lck_versioned_hs', 'arttree_lck_versioned_hs', 'btree_lf_versioned_ls', 'btree_lf_versioned_rs', 'hash_inline_cas_versioned_hs', 'hash_inline_lck_versioned_hs', 'hash_block_lck_versioned_hs', 'hash_block_lf_versioned_hs']
 
 for ds in ds_list:
   os.system("echo \"testing: " + ds + "\"")
@@ -1,4 +1,8 @@
 #include <verlib/verlib.h>
+#include <verlib/overwrites.h>
+#include <verlib/cursor.h>
+#include <verlib/key_search.h>
+#include <verlib/size_counter.h>
 #include <parlay/primitives.h>
 
 template <typename K>
@@ -9,15 +13,25 @@ struct int_string {
   }
 };
 
+// String traits can also give a std::string_view of a key's bytes (see
+// verlib/string_key.h), in which case leaves compare keys with it
+// rather than byte by byte.
+template <typename String, typename K, typename = void>
+struct has_view : std::false_type {};
+template <typename String, typename K>
+struct has_view<String, K, std::void_t<decltype(String::view(std::declval<const K&>()))>>
+  : std::true_type {};
+
 template <typename K,
           typename V,
           typename String = int_string<K>>
 struct ordered_map {
 
-  enum node_type : char {Full, Indirect, Sparse, Leaf};
+  enum node_type : char {Full, Indirect, Sparse, SmallSparse, Leaf};
 
   constexpr static int max_indirect_size = 64;
   constexpr static int max_sparse_size = 16;
+  constexpr static int max_small_sparse_size = 4;
   static constexpr int max_small_leaf_size = 2;
   static constexpr int max_big_leaf_size = 14;
   
@@ -45,6 +59,7 @@ struct ordered_map {
   };
 
   node* root;
+  verlib::size_counter counts; // number of keys, see size()
   
   using node_ptr = verlib::versioned_ptr<node>;
 
@@ -90,22 +105,36 @@ struct ordered_map {
     indirect_node() : node(Indirect, 0) {};
   };
 
-  // Up to max_sparse_size entries each consisting of a key and
+  // Up to MaxSize entries each consisting of a key and
   // pointer.  The keys are immutable, but the pointers can be
   // changed.  i.e. Adding a new child requires copying, but updating
   // a child can be done in place.
-  struct alignas(64) sparse_node : node {
-    unsigned char keys[max_sparse_size];
-    node_ptr ptr[max_sparse_size];
+  // A sparse node has up to max_sparse_size entries, with the key bytes
+  // searched with a single 16-byte compare.  A small sparse node has
+  // up to max_small_sparse_size, for the many nodes with only a few
+  // children.  It grows into a sparse node when full, and a sparse node
+  // shrinks back into one when a remove leaves it with fewer children.
+  static_assert(max_sparse_size <= 16);
+  template <int MaxSize>
+  struct generic_sparse_node : node {
+    static constexpr node_type type =
+      (MaxSize == max_sparse_size) ? Sparse : SmallSparse;
+    unsigned char keys[MaxSize];
+    node_ptr ptr[MaxSize];
 
-    bool is_full() {return node::size == max_sparse_size;}
+    bool is_full() {return node::size == MaxSize;}
 
     node_ptr* get_child(const K& k) {
-      __builtin_prefetch (((char*) ptr) + 64);
       int kb = String::get_byte(k, header::byte_num);
-      for (int i=0; i < node::size; i++) 
-        if (keys[i] == kb) return &ptr[i];
-      return nullptr;
+      if constexpr (MaxSize == 16) {
+        __builtin_prefetch (((char*) ptr) + 64);
+        int i = key_search::match_byte(keys, node::size, kb);
+        return (i == -1) ? nullptr : &ptr[i];
+      } else {
+        for (int i=0; i < node::size; i++) 
+          if (keys[i] == kb) return &ptr[i];
+        return nullptr;
+      }
     }
 
     void init_child(const K& k, node* c) {
@@ -115,8 +144,8 @@ struct ordered_map {
     }
 
     // constructor for a new sparse node with two children
-    sparse_node(int byte_num, node* v1, const K& k1, node* v2, const K& k2)
-      : node(k1, Sparse, 2, byte_num) {
+    generic_sparse_node(int byte_num, node* v1, const K& k1, node* v2, const K& k2)
+      : node(k1, type, 2, byte_num) {
       // if (k1 == k2) {
       //         std::cout << "new sparse: " << k1 << ", " << k2 << ", " << byte_num << std::endl;
       //         abort();
@@ -127,8 +156,8 @@ struct ordered_map {
       ptr[1].init(v2);
     }
 
-    sparse_node(int byte_num, node** start, node** end) :
-      node((*start)->key, Sparse, end-start, byte_num) {
+    generic_sparse_node(int byte_num, node** start, node** end) :
+      node((*start)->key, type, end-start, byte_num) {
       for (int i=0; i < (end-start); i++) {
         keys[i] = String::get_byte((*(start+i))->key, byte_num);
         ptr[i] = *(start + i);
@@ -136,9 +165,28 @@ struct ordered_map {
     }
     
     // an empty sparse node
-    sparse_node() : node(Sparse,0) {}
+    generic_sparse_node() : node(type,0) {}
   };
 
+  struct alignas(64) sparse_node : generic_sparse_node<max_sparse_size> {
+    using generic_sparse_node<max_sparse_size>::generic_sparse_node;
+  };
+  struct small_sparse_node : generic_sparse_node<max_small_sparse_size> {
+    using generic_sparse_node<max_small_sparse_size>::generic_sparse_node;
+  };
+
+  static bool is_sparse(node* p) {return p->nt == Sparse || p->nt == SmallSparse;}
+
+  // key bytes and child pointers of either kind of sparse node
+  static unsigned char* sparse_keys(node* p) {
+    if (p->nt == Sparse) return ((sparse_node*) p)->keys;
+    return ((small_sparse_node*) p)->keys;
+  }
+  static node_ptr* sparse_ptrs(node* p) {
+    if (p->nt == Sparse) return ((sparse_node*) p)->ptr;
+    return ((small_sparse_node*) p)->ptr;
+  }
+
   struct KV {K key; V value;};
 
   template <int MaxSize>
@@ -149,6 +197,13 @@ struct ordered_map {
     // starts comparing a and b at the start byte (prior bytes are equal)
     // -1 if a < b, 0 if equal and 1 if a > b
     static int cmp(const K& a, const K& b, int start_byte) {
+      if constexpr (has_view<String, K>::value) {
+        std::string_view va = String::view(a);
+        std::string_view vb = String::view(b);
+        size_t s = start_byte;
+        int x = va.substr(std::min(s, va.size())).compare(vb.substr(std::min(s, vb.size())));
+        return (x < 0) ? -1 : ((x == 0) ? 0 : 1);
+      }
       int la = String::length(a);
       int lb = String::length(b);
       int l = std::min(la,lb);
@@ -158,24 +213,33 @@ struct ordered_map {
       return (String::get_byte(a,i) < String::get_byte(b,i)) ? -1 : 1;
     } 
 
-    std::optional<V> find(const K& k, int byte_pos) {
-      // if integer than just search leaf using <.
-      if constexpr (std::is_integral_v<K>) {
+    // position of k in the leaf, or -1 if not present
+    int find_index(const K& k, int byte_pos) {
+      // if integer than just search leaf using <, vectorized if possible
+      if constexpr (key_search::vectorized<K, std::less<K>, sizeof(KV)>) {
+        int i = key_search::count<K, false, sizeof(KV)>(&key_vals[0].key, header::size, k);
+        return (i < header::size && key_vals[i].key == k) ? i : -1;
+      } else if constexpr (std::is_integral_v<K>) {
         for (int i = 0; i < header::size; i++) {
             if (!(key_vals[i].key < k))
-            if (k < key_vals[i].key) return {};
-            else return key_vals[i].value;
+            if (k < key_vals[i].key) return -1;
+            else return i;
         }
       } else {
-        if (byte_pos < header::byte_num) return {};
+        if (byte_pos < header::byte_num) return -1;
         for (int i = 0; i < header::size; i++) {
             int x = cmp(key_vals[i].key, k, byte_pos);
           if (x != -1)
-            if (x == 1) return {};
-            else return key_vals[i].value;
+            if (x == 1) return -1;
+            else return i;
         }
       }
-      return {};}
+      return -1;}
+
+    std::optional<V> find(const K& k, int byte_pos) {
+      int i = find_index(k, byte_pos);
+      if (i == -1) return {};
+      return leaf_value((leaf_ptr) this, i);}
 
     static int first_diff(int byte_pos, KV* start, KV* end) {
       if (end-start == 1) return String::length(start->key);
@@ -217,7 +281,8 @@ struct ordered_map {
     // add to leaf
     generic_leaf(int byte_pos, leaf_ptr l, K& key, V& value) 
       : header(l->key, Leaf, l->size + 1, byte_pos) {
-      insert(l->key_vals, key_vals, l->size, key, value);
+      KV tmp[max_big_leaf_size];
+      insert(leaf_key_vals(l, tmp), key_vals, l->size, key, value);
       // for (int i = 1; i < header::size; i++)
       //         if (!(key_vals[i-1].key < key_vals[i].key)) {
       //           std::cout << "x out of order at leaf: " << i << ", " << header::size << ", " << std::hex << 
@@ -229,23 +294,64 @@ struct ordered_map {
     // remove from leaf
     generic_leaf(leaf_ptr l, K& key) 
       : header(l->key, Leaf, l->size - 1, 0) {
+      KV tmp[max_big_leaf_size];
+      KV* kvs = leaf_key_vals(l, tmp);
       int j = 0;
       for (int i=0; i < l->size; i++) {
-        if (l->key_vals[i].key != key) 
-          key_vals[j++] = l->key_vals[i];
+        if (kvs[i].key != key) 
+          key_vals[j++] = kvs[i];
       }
       header::key = key_vals[0].key;
       header::byte_num = first_diff(l->byte_num, &key_vals[0], &key_vals[header::size]);
     }
 
+    // copy of leaf with the value at position i replaced
+    generic_leaf(leaf_ptr l, int i, const V& value)
+      : header(l->key, Leaf, l->size, l->byte_num) {
+      KV tmp[max_big_leaf_size];
+      KV* kvs = leaf_key_vals(l, tmp);
+      for (int j=0; j < l->size; j++) key_vals[j] = kvs[j];
+      key_vals[i].value = value;
+    }
+
   };
   using leaf = generic_leaf<0>; // only used generically
   using small_leaf = generic_leaf<max_small_leaf_size>;
-  using big_leaf = generic_leaf<max_big_leaf_size>;
+
+  // Big leaves can also have values overwritten in place by an
+  // upsert, up to max_overwrites times, rather than being copied.
+  // Small leaves are a single cache line so are just copied.
+  using overwrites = verlib::overwrites<V>;
+  static constexpr int max_overwrites = 4;
+  struct big_leaf : generic_leaf<max_big_leaf_size> {
+    using generic_leaf<max_big_leaf_size>::generic_leaf;
+    overwrites ow;
+  };
+
+  static const V& leaf_value(leaf* l, int i) {
+    if (l->size <= max_small_leaf_size) return l->key_vals[i].value;
+    return overwrites::get(((big_leaf*) l)->ow.load(), i, l->key_vals[i].value);
+  }
+
+  // the key-values of l with overwrites applied, copied to tmp if needed
+  static KV* leaf_key_vals(leaf* l, KV* tmp) {
+    if (l->size <= max_small_leaf_size) return l->key_vals;
+    auto o = ((big_leaf*) l)->ow.load();
+    if (overwrites::size(o) == 0) return l->key_vals;
+    for (int i = 0; i < l->size; i++)
+      tmp[i] = KV{l->key_vals[i].key, overwrites::get(o, i, l->key_vals[i].value)};
+    return tmp;
+  }
+
+  static void retire_big_leaf(big_leaf* l) {
+    l->ow.retire();
+    big_leaf_pool.retire(l);
+  }
   
   static verlib::memory_pool<full_node> full_pool;
   static verlib::memory_pool<indirect_node> indirect_pool;
   static verlib::memory_pool<sparse_node> sparse_pool;
+  static verlib::memory_pool<small_sparse_node> small_sparse_pool;
   static verlib::memory_pool<small_leaf> small_leaf_pool;
   static verlib::memory_pool<big_leaf> big_leaf_pool;
 
@@ -256,6 +362,7 @@ struct ordered_map {
     case Full : return ((full_node*) x)->get_child(k);
     case Indirect : return ((indirect_node*) x)->get_child(k);
     case Sparse : return ((sparse_node*) x)->get_child(k);
+    case SmallSparse : return ((small_sparse_node*) x)->get_child(k);
     }
     return nullptr;
   }
@@ -266,10 +373,32 @@ struct ordered_map {
     case Full : return ((full_node*) p)->is_full(); // never full
     case Indirect : return ((indirect_node*) p)->is_full();
     case Sparse : return ((sparse_node*) p)->is_full();
+    case SmallSparse : return ((small_sparse_node*) p)->is_full();
     }
     return false;
   }
 
+  // copies sparse node s_n into s_c (with room for one more) and
+  // adds child c with key k
+  template <typename From, typename To>
+  static void copy_sparse(From* s_n, To* s_c, const K& k, node* c) {
+    s_c->key = s_n->key;
+    s_c->byte_num = s_n->byte_num;
+    s_c->size = s_n->size + 1;
+    for (int i=0; i < s_n->size; i++) {
+      s_c->keys[i] = s_n->keys[i];
+      s_c->ptr[i].init(s_n->ptr[i].load());
+    }
+    s_c->init_child(k, c);
+  }
+
+  // a new sparse node with the given children, small if they fit
+  static node* new_sparse(int byte_pos, node** start, node** end) {
+    if (end - start <= max_small_sparse_size)
+      return (node*) small_sparse_pool.new_obj(byte_pos, start, end);
+    return (node*) sparse_pool.new_obj(byte_pos, start, end);
+  }
+
   // Adds a new child to p with key k and value v
   // gp is p's parent (i.e. grandparent)
   // This involve copying p and updating gp to point to it.
@@ -315,6 +444,17 @@ struct ordered_map {
                   i_c->init_child(k, c);});
                 }
                 indirect_pool.retire(i_n);
+              } else if (p->nt == SmallSparse) {
+                small_sparse_node* s_n = (small_sparse_node*) p;
+                s_n->removed = true;
+                // copy small sparse to sparse if full, else to small sparse
+                if (is_full(p))
+                  *child_ptr = (node*) sparse_pool.new_init([=] (sparse_node* s_c) {
+                    copy_sparse(s_n, s_c, k, c);});
+                else
+                  *child_ptr = (node*) small_sparse_pool.new_init([=] (small_sparse_node* s_c) {
+                    copy_sparse(s_n, s_c, k, c);});
+                small_sparse_pool.retire(s_n);
               } else { // (p->nt == Sparse)
                 sparse_node* s_n = (sparse_node*) p;
                 s_n->removed = true;
@@ -334,14 +474,7 @@ struct ordered_map {
                 } else {
                   // copy sparse to sparse
                   *child_ptr = (node*) sparse_pool.new_init([=] (sparse_node* s_c) {
-                      s_c->key = s_n->key;
-                    s_c->byte_num = s_n->byte_num;
-                    s_c->size = s_n->size + 1;
-                    for (int i=0; i < s_n->size; i++) {
-                      s_c->keys[i] = s_n->keys[i];
-                      s_c->ptr[i].init(s_n->ptr[i].load());
-                    }
-                    s_c->init_child(k, c);});
+                    copy_sparse(s_n, s_c, k, c);});
                 }
                 sparse_pool.retire(s_n);
             }
@@ -383,24 +516,91 @@ struct ordered_map {
   }
   
   bool insert_(const K& k, const V& v) {
-    return flck::try_loop([&] () {return try_insert(k, v);});}
+    bool r = !flck::try_loop([&] () {
+      return try_apply(k, [=] (const std::optional<V>&) {return v;}, true, false);});
+    if (r) counts.increment();
+    return r;}
 
   bool insert(const K& k, const V& v) {
     return verlib::with_epoch([=] { return insert_(k, v);});}
   
-  std::optional<bool> try_insert(const K& k, const V& v, bool upsert=false) {
+  // Inserts or replaces the value.  Overwrites a big leaf in place if
+  // possible, otherwise copies the leaf.
+  bool upsert_(const K& k, const V& v) {
+    if (!flck::try_loop([&] () {
+	  return try_apply(k, [=] (const std::optional<V>&) {return v;}, true, true);}))
+      counts.increment();
+    return true;}
+
+  bool upsert(const K& k, const V& v) {
+    return verlib::with_epoch([=] { return upsert_(k, v);});}
+
+  // Read-modify-write upsert and update, as in btree.
+  template <typename F,
+            typename = std::enable_if_t<std::is_invocable_v<F, std::optional<V>>>>
+  bool upsert_(const K& k, const F& f) {
+    bool r = !flck::try_loop([&] () {return try_apply(k, f, true, true);});
+    if (r) counts.increment();
+    return r;}
+
+  template <typename F,
+            typename = std::enable_if_t<std::is_invocable_v<F, std::optional<V>>>>
+  bool upsert(const K& k, const F& f) {
+    return verlib::with_epoch([&] { return upsert_(k, f);});}
+
+  template <typename F>
+  bool update_(const K& k, const F& f) {
+    return flck::try_loop([&] () {
+      return try_apply(k, [f] (const std::optional<V>& v) {return f(*v);}, false, true);});}
+
+  template <typename F>
+  bool update(const K& k, const F& f) {
+    return verlib::with_epoch([&] { return update_(k, f);});}
+
+  // Shared by insert, upsert and update, as in btree.  A value is
+  // replaced under the lock of the leaf's parent.  When k is added as
+  // a new child of a node, f is applied before taking the locks.
+  template <typename F>
+  std::optional<bool> try_apply(const K& k, const F& f,
+                                bool insert_if_absent, bool replace_if_present) {
     auto [gp, p, cptr, c, byte_pos] = find_location(root, k);
     //std::cout << byte_pos << std::endl;
-    if (c != nullptr && c->is_leaf() &&
-        ((leaf*) c)->find(k, byte_pos).has_value()) // already in the tree
-      if (p->lck.read_lock([&] {return (cptr->load() == c) && !p->removed.load();}))
-        return false;
+    int idx = (c != nullptr && c->is_leaf()) ? ((leaf*) c)->find_index(k, byte_pos) : -1;
+    bool found = idx != -1;
+    if (found ? !replace_if_present : !insert_if_absent) // nothing to do
+      // cptr is null if p has no slot for k
+      if (p->lck.read_lock([&] {return (cptr == nullptr || cptr->load() == c) && !p->removed.load();}))
+        return found;
       else return {};
 
+    if (found) {
+      if (p->lck.try_lock([=] {
+          if (p->removed.load() || cptr->load() != c) return false;
+          leaf* l = (leaf*) c;
+          if (l->size <= max_small_leaf_size) {
+            V v = f(std::optional<V>(l->key_vals[idx].value));
+            *cptr = (node*) small_leaf_pool.new_obj(l, idx, v);
+            small_leaf_pool.retire((small_leaf*) l);
+          } else {
+            big_leaf* bl = (big_leaf*) c;
+            auto o = bl->ow.load();
+            V v = f(std::optional<V>(overwrites::get(o, idx, l->key_vals[idx].value)));
+            if (overwrites::size(o) < max_overwrites)
+              bl->ow.add(o, idx, v);  // overwrite the value in place
+            else {
+              *cptr = (node*) big_leaf_pool.new_obj(l, idx, v);
+              retire_big_leaf(bl);
+            }
+          }
+          return true;})) return true;
+      return {};
+    }
+
     if (cptr != nullptr) {// child pointer exists, always true for full node
       if (p->lck.try_lock([=] {
            // exit and retry if state has changed
           if (p->removed.load() || cptr->load() != c) return false;
+          V v = f(std::optional<V>());
 
           // fill a null pointer with the new leaf
           if (c == nullptr)
@@ -417,13 +617,14 @@ struct ordered_map {
               small_leaf_pool.retire(sl);
             } else if (l->size < max_big_leaf_size) {
               *cptr = (node*) big_leaf_pool.new_obj(byte_pos, l, k, v);
-              big_leaf_pool.retire(bl);
+              retire_big_leaf(bl);
             } else { // too large
               int n = max_big_leaf_size + 1;
 
               // insert new key-value pair into l and put result into tmp
               KV tmp[n];
-              leaf::insert(l->key_vals, tmp, n - 1, k, v);
+              KV cur[max_big_leaf_size];
+              leaf::insert(leaf_key_vals(l, cur), tmp, n - 1, k, v);
               // for (int i=0; i < max_big_leaf_size; i++)
               //          tmp[i] = l->key_vals[i];
               // tmp[max_big_leaf_size] = KV{k,v};
@@ -445,18 +646,18 @@ struct ordered_map {
               children[j++] = new_leaf(byte_pos+1, &tmp[start], &tmp[n]);
 
               // insert the new leaves into a sparse node
-              *cptr = (node*) sparse_pool.new_obj(byte_pos, &children[0], &children[j]);
-              big_leaf_pool.retire(bl);
+              *cptr = new_sparse(byte_pos, &children[0], &children[j]);
+              retire_big_leaf(bl);
             }
           } else { // not a leaf
             node* new_l = (node*) small_leaf_pool.new_obj(k, v);
-            *cptr = (node*) sparse_pool.new_obj(byte_pos, c, c->key,
-                                                new_l, k);
+            *cptr = (node*) small_sparse_pool.new_obj(byte_pos, c, c->key,
+                                                      new_l, k);
           }
-          return true;})) return true;
+          return true;})) return false;
     } else { // no child pointer, need to add
-      bool x = add_child(gp, p, k, v);
-      if (x) return true;
+      bool x = add_child(gp, p, k, f(std::optional<V>()));
+      if (x) return false;
     }
     return {};
   }
@@ -464,11 +665,11 @@ struct ordered_map {
   // returns other child if node is sparse and has two children, one
   // of which is c, otherwise returns nullptr
   static node* single_other_child(node* p, node* c) {
-    if (p->nt != Sparse) return nullptr;
-    sparse_node* ps = (sparse_node*) p;
+    if (!is_sparse(p)) return nullptr;
+    node_ptr* ptrs = sparse_ptrs(p);
     node* result = nullptr;
-    for (int i=0; i < ps->size; i++) {
-      node* oc = ps->ptr[i].load();
+    for (int i=0; i < p->size; i++) {
+      node* oc = ptrs[i].load();
       if (oc != nullptr && oc != c)
         if (result != nullptr) return nullptr; // quit if second child
         else result = oc; // set first child
@@ -476,8 +677,53 @@ struct ordered_map {
     return result;
   }
 
+  // number of non-null children of a sparse node
+  static int num_children(node* p) {
+    node_ptr* ptrs = sparse_ptrs(p);
+    int n = 0;
+    for (int i=0; i < p->size; i++)
+      if (ptrs[i].load() != nullptr) n++;
+    return n;
+  }
+
+  // Removes the singleton leaf c from sparse node p by replacing p with
+  // a small sparse node holding p's other non-null children.  Just
+  // removes c if there are now too many of them.  Returns false if it
+  // fails.
+  static bool shrink_sparse(node* gp, node* p, node* c) {
+    return gp->lck.try_lock([=] {
+      auto child_ptr = get_child(gp, p->key);
+      if (gp->removed.load() || child_ptr->load() != p) return false;
+      return p->lck.try_lock([=] {
+        sparse_node* s_n = (sparse_node*) p;
+        node_ptr* cptr = get_child(p, c->key);
+        if (p->removed.load() || cptr->load() != c) return false;
+        if (num_children(p) > max_small_sparse_size) {
+          *cptr = nullptr;
+        } else {
+          s_n->removed = true;
+          *child_ptr = (node*) small_sparse_pool.new_init([=] (small_sparse_node* s_c) {
+            s_c->key = s_n->key;
+            s_c->byte_num = s_n->byte_num;
+            int j = 0;
+            for (int i=0; i < s_n->size; i++) {
+              node* oc = s_n->ptr[i].load();
+              if (oc != nullptr && oc != c) {
+                s_c->keys[j] = s_n->keys[i];
+                s_c->ptr[j++].init(oc);
+              }
+            }
+            s_c->size = j;});
+          sparse_pool.retire(s_n);
+        }
+        small_leaf_pool.retire((small_leaf*) c);
+        return true;});});
+  }
+
   bool remove_(const K& k) {
-    return flck::try_loop([&] () {return try_remove(k);});}
+    bool r = flck::try_loop([&] () {return try_remove(k);});
+    if (r) counts.decrement();
+    return r;}
 
   bool remove(const K& k) {
     return verlib::with_epoch([=] { return remove_(k);});}
@@ -489,9 +735,15 @@ struct ordered_map {
     auto [gp, p, cptr, c, byte_pos] = find_location(root, k);
     // if not found return
     if (c == nullptr || !(c->is_leaf() && ((leaf*) c)->find(k, byte_pos).has_value()))
-      if (p->lck.read_lock([&] {return (cptr->load() == c) && !p->removed.load();}))
+      // cptr is null if p has no slot for k
+      if (p->lck.read_lock([&] {return (cptr == nullptr || cptr->load() == c) && !p->removed.load();}))
         return false;
       else return {};
+    if (((leaf*) c)->size == 1 && p->nt == Sparse && gp != nullptr &&
+        num_children(p) <= max_small_sparse_size) {
+      if (shrink_sparse(gp, p, c)) return true;
+      return {};
+    }
     if (p->lck.try_lock([=] {
         if (p->removed.load() || cptr->load() != c) return false;
         leaf* l = (leaf*) c;
@@ -517,10 +769,10 @@ struct ordered_map {
         } else { // at least 2 in leaf
           if (l->size > max_small_leaf_size + 1) {
             *cptr = (node*) big_leaf_pool.new_obj(l, k);
-            big_leaf_pool.retire((big_leaf*) l);
+            retire_big_leaf((big_leaf*) l);
           } else if (l->size == max_small_leaf_size + 1) {
             *cptr = (node*) small_leaf_pool.new_obj(l, k);
-            big_leaf_pool.retire((big_leaf*) l);
+            retire_big_leaf((big_leaf*) l);
           } else {
             *cptr = (node*) small_leaf_pool.new_obj(l, k);
             small_leaf_pool.retire((small_leaf*) l);
@@ -549,25 +801,67 @@ struct ordered_map {
   std::optional<V> find(const K& k) {
     return verlib::with_epoch([&] {return find_(k);}); }
 
+  // Batched versions that run the whole batch inside one epoch
+  // announcement.  out[i] is set to the result for keys[i], and the
+  // updates return the number that succeeded.
+  template <typename Keys, typename Out>
+  void multi_find(const Keys& keys, Out& out) {
+    verlib::with_epoch([&] {
+      for (size_t i = 0; i < keys.size(); i++) out[i] = find_(keys[i]);});
+  }
+
+  template <typename KVs>
+  long multi_insert(const KVs& kvs) {
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < kvs.size(); i++)
+        cnt += insert_(kvs[i].first, kvs[i].second);
+      return cnt;});
+  }
+
+  template <typename Keys>
+  long multi_remove(const Keys& keys) {
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < keys.size(); i++) cnt += remove_(keys[i]);
+      return cnt;});
+  }
+
   std::optional<V> find_locked(const K& k) {
     return flck::try_loop([&] {return try_find(k);}); }
 
+  // add(k, v) can return false to stop the range query early
   template<typename AddF>
-  static void range_internal(node* a, AddF& add,
-                      std::optional<K> start, std::optional<K> end, int pos) {
-    if (a == nullptr) return;
+  static bool call_add(AddF& add, const K& k, const V& v) {
+    if constexpr (std::is_same_v<std::invoke_result_t<AddF&, const K&, const V&>, bool>)
+      return add(k, v);
+    else {add(k, v); return true;}
+  }
+
+  // Visits keys from start to end (both inclusive) in ascending or
+  // descending order.  An empty start or end means unbounded.  Returns
+  // false if stopped early.
+  template<typename AddF>
+  static bool range_internal(node* a, AddF& add,
+                      std::optional<K> start, std::optional<K> end, int pos,
+                      bool ascending = true) {
+    if (a == nullptr) return true;
     std::optional<K> empty;
     if (a->nt == Leaf) {
       leaf* l = (leaf*) a;
       int s = 0;
       int e = a->size;
       if (start.has_value())
-        while (l->key_vals[s].key < *start) s++;
+        while (s < e && l->key_vals[s].key < *start) s++;
       if (end.has_value())
-        while (l->key_vals[e-1].key > *end) e--;
-      for (int i = s; i < e; i++)
-        add(l->key_vals[i].key, l->key_vals[i].value);
-      return;
+        while (e > s && l->key_vals[e-1].key > *end) e--;
+      KV tmp[max_big_leaf_size];
+      KV* kvs = leaf_key_vals(l, tmp);
+      for (int j = 0; j < e - s; j++) {
+        int i = ascending ? s + j : e - 1 - j;
+        if (!call_add(add, kvs[i].key, kvs[i].value)) return false;
+      }
+      return true;
     }
     for (int i = pos; i < a->byte_num; i++) {
       if (start == empty && end == empty) break;
@@ -575,7 +869,7 @@ struct ordered_map {
           && String::get_byte(start.value(), i) > String::get_byte(a->key, i)
           || end.has_value()
           && String::get_byte(end.value(), i) < String::get_byte(a->key, i))
-        return;
+        return true;
       if (start.has_value() &&
           String::get_byte(start.value(), i) < String::get_byte(a->key,i)) 
         start = empty;
@@ -587,26 +881,36 @@ struct ordered_map {
     int sb = start.has_value() ? String::get_byte(start.value(), a->byte_num) : 0;
     int eb = end.has_value() ? String::get_byte(end.value(), a->byte_num) : 255;
     if (a->nt == Full) {
-      for (int i = sb; i <= eb; i++) 
-        range_internal(((full_node*) a)->children[i].read_snapshot(), add,
-                       start, end, a->byte_num);
+      for (int j = 0; j <= eb - sb; j++) {
+        int i = ascending ? sb + j : eb - j;
+        if (!range_internal(((full_node*) a)->children[i].read_snapshot(), add,
+                            start, end, a->byte_num, ascending))
+          return false;
+      }
     } else if (a->nt == Indirect) {
-      for (int i = sb; i <= eb; i++) {
+      for (int j = 0; j <= eb - sb; j++) {
+        int i = ascending ? sb + j : eb - j;
         indirect_node* ai = (indirect_node*) a;
         int o = ai->idx[i];
         if (o != -1) {
-          range_internal(ai->ptr[o].read_snapshot(), add,
-                                    start, end, a->byte_num);
+          if (!range_internal(ai->ptr[o].read_snapshot(), add,
+                              start, end, a->byte_num, ascending))
+            return false;
         }
       }
     } else { // Sparse
-      sparse_node* as = (sparse_node*) a;
-      for (int i = 0; i < as->size; i++) {
-        int b = as->keys[i];
-        if (b >= sb && b <= eb)
-          range_internal(as->ptr[i].read_snapshot(), add, start, end, a->byte_num);
+      std::pair<int,int> bs[max_sparse_size];
+      int n = sparse_children_in_order(a, ascending ? sb : eb, ascending, bs);
+      node_ptr* ptrs = sparse_ptrs(a);
+      for (int j = 0; j < n; j++) {
+        auto [b, i] = bs[j];
+        if (ascending ? b > eb : b < sb) break;
+        if (!range_internal(ptrs[i].read_snapshot(), add,
+                            start, end, a->byte_num, ascending))
+          return false;
       }
     }
+    return true;
   }                       
 
   template<typename AddF>
@@ -615,6 +919,220 @@ struct ordered_map {
                    std::optional<K>(start), std::optional<K>(end), 0);
   }
 
+  // The first (up to) n key-values with keys not less than start.
+  // Costs O(n) beyond the descent rather than the size of a window.
+  parlay::sequence<std::pair<K,V>> range_limit_(const K& start, size_t n) {
+    parlay::sequence<std::pair<K,V>> out;
+    if (n == 0) return out;
+    auto add = [&] (const K& k, const V& v) {
+      out.push_back(std::pair(k, v));
+      return out.size() < n;};
+    range_internal(root, add, std::optional<K>(start), std::optional<K>(), 0);
+    return out;
+  }
+
+  parlay::sequence<std::pair<K,V>> range_limit(const K& start, size_t n) {
+    return verlib::with_snapshot([&] {return range_limit_(start, n);});
+  }
+
+  // same keys as range_, but largest first
+  template<typename AddF>
+  void range_desc_(AddF& add, const K& start, const K& end) {
+    range_internal(root, add,
+                   std::optional<K>(start), std::optional<K>(end), 0, false);
+  }
+
+  // The last (up to) n key-values with keys not greater than from,
+  // largest first.
+  parlay::sequence<std::pair<K,V>> range_desc_limit_(const K& from, size_t n) {
+    parlay::sequence<std::pair<K,V>> out;
+    if (n == 0) return out;
+    auto add = [&] (const K& k, const V& v) {
+      out.push_back(std::pair(k, v));
+      return out.size() < n;};
+    range_internal(root, add, std::optional<K>(), std::optional<K>(from), 0, false);
+    return out;
+  }
+
+  parlay::sequence<std::pair<K,V>> range_desc_limit(const K& from, size_t n) {
+    return verlib::with_snapshot([&] {return range_desc_limit_(from, n);});
+  }
+
+  // Applies add(k, v) in key order to every key whose first n bytes
+  // match those of prefix (n defaults to the length of the prefix if
+  // the String traits have a view).  Descends to the node for the
+  // prefix and scans its subtree.  add can return false to stop.
+  template<typename AddF>
+  void prefix_scan_(const K& prefix, int n, AddF& add) {
+    node* a = root;
+    int pos = 0;
+    auto matches = [&] (const K& k, int start, int end) {
+      for (int i = start; i < end; i++)
+        if (String::get_byte(k, i) != String::get_byte(prefix, i)) return false;
+      return true;};
+    while (a != nullptr) {
+      if (a->nt == Leaf) {
+        leaf* l = (leaf*) a;
+        KV tmp[max_big_leaf_size];
+        KV* kvs = leaf_key_vals(l, tmp);
+        for (int i = 0; i < l->size; i++)
+          if (matches(kvs[i].key, pos, n) &&
+              !call_add(add, kvs[i].key, kvs[i].value)) return;
+        return;
+      }
+      // all keys below a share a's first byte_num bytes
+      if (!matches(a->key, pos, std::min<int>(a->byte_num, n))) return;
+      if (a->byte_num >= n) {
+        range_internal(a, add, std::optional<K>(), std::optional<K>(), pos);
+        return;
+      }
+      node_ptr* cptr = get_child(a, prefix);
+      if (cptr == nullptr) return;
+      pos = a->byte_num + 1;
+      a = cptr->load();
+    }
+  }
+
+  template<typename AddF>
+  void prefix_scan_(const K& prefix, AddF& add) {
+    static_assert(has_view<String, K>::value,
+                  "give the number of prefix bytes for keys without a view");
+    prefix_scan_(prefix, String::view(prefix).size(), add);
+  }
+
+  // Runs in a snapshot that is not speculative, so it is never
+  // retried and add is applied as the keys are found, once each.
+  template<typename AddF>
+  void prefix_scan(const K& prefix, int n, AddF& add) {
+    verlib::with_snapshot([&] {prefix_scan_(prefix, n, add);}, false);
+  }
+
+  template<typename AddF>
+  void prefix_scan(const K& prefix, AddF& add) {
+    verlib::with_snapshot([&] {prefix_scan_(prefix, add);}, false);
+  }
+
+  // A cursor over a snapshot taken now, starting at start, which returns
+  // key-values in batches in ascending (or descending) order (see
+  // verlib/cursor.h)
+  using cursor_t = verlib::cursor<ordered_map, K, V>;
+  cursor_t cursor(const K& start) {return cursor_t(*this, start);}
+  cursor_t cursor_desc(const K& start) {return cursor_t(*this, start, true);}
+
+  // Ordered queries.  lower_bound finds the first key not less than
+  // k, successor the first key greater than k, and predecessor the
+  // last key less than k.  The versions with an underscore can be used
+  // inside a snapshot (or on their own, but then they are not atomic
+  // if they cross leaves), the others take their own snapshot.
+  using kv_opt = std::optional<std::pair<K,V>>;
+
+  // The (byte, index) of the children of sparse node a with byte from
+  // start upwards (downwards if not ascending), in that order, put in
+  // bs.  Returns how many.  Sparse nodes are not sorted.
+  static int sparse_children_in_order(node* a, int start, bool ascending,
+                                      std::pair<int,int>* bs) {
+    unsigned char* keys = sparse_keys(a);
+    int n = 0;
+    for (int i = 0; i < a->size; i++)
+      if (ascending ? keys[i] >= start : keys[i] <= start)
+        bs[n++] = std::pair((int) keys[i], i);
+    std::sort(bs, bs + n);
+    if (!ascending) std::reverse(bs, bs + n);
+    return n;
+  }
+
+  // Applies f(b, child) to the children of internal node a with byte b
+  // from start upwards (downwards if not ascending), until one returns
+  // a result.
+  template <typename F>
+  static kv_opt scan_children(node* a, int start, bool ascending, F f) {
+    int step = ascending ? 1 : -1;
+    if (a->nt == Full) {
+      full_node* af = (full_node*) a;
+      for (int b = start; b >= 0 && b < 256; b += step)
+        if (kv_opt r = f(b, af->children[b].load()); r.has_value()) return r;
+    } else if (a->nt == Indirect) {
+      indirect_node* ai = (indirect_node*) a;
+      for (int b = start; b >= 0 && b < 256; b += step) {
+        int o = ai->idx[b];
+        if (o != -1)
+          if (kv_opt r = f(b, ai->ptr[o].load()); r.has_value()) return r;
+      }
+    } else { // Sparse or SmallSparse
+      node_ptr* ptrs = sparse_ptrs(a);
+      std::pair<int,int> bs[max_sparse_size];
+      int n = sparse_children_in_order(a, start, ascending, bs);
+      for (int j = 0; j < n; j++) {
+        auto [b, i] = bs[j];
+        if (kv_opt r = f(b, ptrs[i].load()); r.has_value()) return r;
+      }
+    }
+    return {};
+  }
+
+  // first in the subtree a with key >= k (> k if strict), or the
+  // smallest if k is empty.  Bytes of k before pos are already known
+  // to match.
+  static kv_opt next_internal(node* a, std::optional<K> k, bool strict, int pos) {
+    if (a == nullptr) return {};
+    if (a->nt == Leaf) {
+      leaf* l = (leaf*) a;
+      KV tmp[max_big_leaf_size];
+      KV* kvs = leaf_key_vals(l, tmp);
+      for (int i = 0; i < l->size; i++)
+        if (!k.has_value() || (strict ? *k < kvs[i].key : !(kvs[i].key < *k)))
+          return std::pair(kvs[i].key, kvs[i].value);
+      return {};
+    }
+    for (int i = pos; k.has_value() && i < a->byte_num; i++) {
+      int kb = String::get_byte(*k, i);
+      int ab = String::get_byte(a->key, i);
+      if (kb < ab) k.reset();       // whole subtree is greater
+      else if (kb > ab) return {};  // whole subtree is less
+    }
+    int start = k.has_value() ? String::get_byte(*k, a->byte_num) : 0;
+    return scan_children(a, start, true, [&] (int b, node* c) {
+      return next_internal(c, (b == start) ? k : std::optional<K>(), strict, a->byte_num);});
+  }
+
+  // last in the subtree a with key < k, or the largest if k is empty
+  static kv_opt prev_internal(node* a, std::optional<K> k, int pos) {
+    if (a == nullptr) return {};
+    if (a->nt == Leaf) {
+      leaf* l = (leaf*) a;
+      KV tmp[max_big_leaf_size];
+      KV* kvs = leaf_key_vals(l, tmp);
+      for (int i = l->size - 1; i >= 0; i--)
+        if (!k.has_value() || kvs[i].key < *k)
+          return std::pair(kvs[i].key, kvs[i].value);
+      return {};
+    }
+    for (int i = pos; k.has_value() && i < a->byte_num; i++) {
+      int kb = String::get_byte(*k, i);
+      int ab = String::get_byte(a->key, i);
+      if (kb > ab) k.reset();       // whole subtree is less
+      else if (kb < ab) return {};  // whole subtree is greater
+    }
+    int start = k.has_value() ? String::get_byte(*k, a->byte_num) : 255;
+    return scan_children(a, start, false, [&] (int b, node* c) {
+      return prev_internal(c, (b == start) ? k : std::optional<K>(), a->byte_num);});
+  }
+
+  kv_opt lower_bound_(const K& k) {return next_internal(root, k, false, 0);}
+  kv_opt successor_(const K& k) {return next_internal(root, k, true, 0);}
+  kv_opt predecessor_(const K& k) {return prev_internal(root, k, 0);}
+  kv_opt min_() {return next_internal(root, {}, false, 0);}
+  kv_opt max_() {return prev_internal(root, {}, 0);}
+
+  kv_opt lower_bound(const K& k) {
+    return verlib::with_snapshot([&] {return lower_bound_(k);});}
+  kv_opt successor(const K& k) {
+    return verlib::with_snapshot([&] {return successor_(k);});}
+  kv_opt predecessor(const K& k) {
+    return verlib::with_snapshot([&] {return predecessor_(k);});}
+  kv_opt min() {return verlib::with_snapshot([&] {return min_();});}
+  kv_opt max() {return verlib::with_snapshot([&] {return max_();});}
+
   ordered_map() {
     auto r = full_pool.new_obj();
     r->byte_num = 0;
@@ -652,12 +1170,11 @@ struct ordered_map {
                }
                return;
              }
-             case Sparse : {
+             case Sparse : case SmallSparse : {
                using pr = std::pair<int,node*>;
-               auto s_n = (sparse_node*) p;
                std::vector<pr> v;
-               for (int i=0; i < s_n->size; i++)
-                 v.push_back(std::make_pair(s_n->keys[i], s_n->ptr[i].load()));
+               for (int i=0; i < p->size; i++)
+                 v.push_back(std::make_pair(sparse_keys(p)[i], sparse_ptrs(p)[i].load()));
                std::sort(v.begin(), v.end()); 
                for (auto x : v) prec(x.second);
                return;
@@ -672,14 +1189,15 @@ struct ordered_map {
     if (p == nullptr) return;
     if (p->nt == Leaf) {
       if (p->size > max_small_leaf_size)
-        big_leaf_pool.retire((big_leaf*) p);
+        retire_big_leaf((big_leaf*) p);
       else small_leaf_pool.retire((small_leaf*) p);
     }
-    else if (p->nt == Sparse) {
-      auto pp = (sparse_node*) p;
-      parlay::parallel_for(0, pp->size, [&] (size_t i) {
-          retire_recursive(pp->ptr[i].load());});
-      sparse_pool.retire(pp);
+    else if (is_sparse(p)) {
+      node_ptr* ptrs = sparse_ptrs(p);
+      parlay::parallel_for(0, p->size, [&] (size_t i) {
+          retire_recursive(ptrs[i].load());});
+      if (p->nt == Sparse) sparse_pool.retire((sparse_node*) p);
+      else small_sparse_pool.retire((small_sparse_node*) p);
     } else if (p->nt == Indirect) {
       auto pp = (indirect_node*) p;
       parlay::parallel_for(0, pp->size, [&] (size_t i) {
@@ -693,6 +1211,9 @@ struct ordered_map {
     }
   }
   ~ordered_map() { retire_recursive(root);}
+
+  // number of keys, exact when no updates are in progress
+  long size() {return counts.get();}
   
   long check() {
     std::function<size_t(node*)> crec;
@@ -722,10 +1243,10 @@ struct ordered_map {
                                                 return (j == -1) ? 0 : crec(i_n->ptr[j].load());});
                return parlay::reduce(x);
              }
-             case Sparse : {
-               auto s_n = (sparse_node*) p;
-               auto x = parlay::tabulate(s_n->size,
-                                         [&] (size_t i) {return crec(s_n->ptr[i].load());});
+             case Sparse : case SmallSparse : {
+               node_ptr* ptrs = sparse_ptrs(p);
+               auto x = parlay::tabulate(p->size,
+                                         [&] (size_t i) {return crec(ptrs[i].load());});
                return parlay::reduce(x);
              }
              }
@@ -739,16 +1260,26 @@ struct ordered_map {
     full_pool.clear();
     indirect_pool.clear();
     sparse_pool.clear();
+    small_sparse_pool.clear();
     small_leaf_pool.clear();
     big_leaf_pool.clear();
   }
 
-  static void reserve(size_t n) {}
+  // about one small leaf per key for dense keys, and fewer (in big
+  // leaves) with more inner nodes for sparse keys
+  static void reserve(size_t n) {
+    full_pool.reserve(n/100);
+    indirect_pool.reserve(n/32);
+    sparse_pool.reserve(n/32);
+    small_leaf_pool.reserve(n);
+    big_leaf_pool.reserve(n/16);
+  }
   
   static void shuffle(size_t n) {
     full_pool.shuffle(n/100);
     indirect_pool.shuffle(n/10);
     sparse_pool.shuffle(n/5);
+    small_sparse_pool.shuffle(n/5);
     small_leaf_pool.shuffle(n);
     big_leaf_pool.shuffle(n);
   }
@@ -757,6 +1288,7 @@ struct ordered_map {
     full_pool.stats();
     indirect_pool.stats();
     sparse_pool.stats();
+    small_sparse_pool.stats();
     small_leaf_pool.stats();
     big_leaf_pool.stats();
   }
@@ -770,6 +1302,8 @@ verlib::memory_pool<typename ordered_map<K,V,S>::indirect_node> ordered_map<K,V,
 template <typename K, typename V, typename S>
 verlib::memory_pool<typename ordered_map<K,V,S>::sparse_node> ordered_map<K,V,S>::sparse_pool;
 template <typename K, typename V, typename S>
+verlib::memory_pool<typename ordered_map<K,V,S>::small_sparse_node> ordered_map<K,V,S>::small_sparse_pool;
+template <typename K, typename V, typename S>
 verlib::memory_pool<typename ordered_map<K,V,S>::small_leaf> ordered_map<K,V,S>::small_leaf_pool;
 template <typename K, typename V, typename S>
 verlib::memory_pool<typename ordered_map<K,V,S>::big_leaf> ordered_map<K,V,S>::big_leaf_pool;
@@ -1,4 +1,6 @@
 #include <verlib/verlib.h>
+#include <verlib/cursor.h>
+#include <verlib/size_counter.h>
 //#include "rebalance.h"
 
 #ifdef BALANCED
@@ -21,6 +23,7 @@ struct ordered_map {
 
   struct node;
   node* root;
+  verlib::size_counter counts; // number of keys, see size()
 
   struct KV {
     K key;
@@ -96,135 +99,139 @@ struct ordered_map {
   // via an atomic_ptr and the pool allocators, which are idempotent.
   // The other values are "immutable" (i.e. they are either written once
   // without being read, or just read).
+  bool insert_(const K& k, const V& v) {
+    while (true) {
+      auto [gp, gp_left, p, p_left, l] = find_location(root, k);
+      leaf* old_l = (leaf*) l;
+      if (old_l->find(k).has_value()) return false; // already there
+      if (p->try_lock([=] {
+	    auto ptr = (p_left) ? &(p->left) : &(p->right);
+
+	    // if p has been removed, or l has changed, then exit
+	    if (p->removed.load() || ptr->load() != l) return false;
+	    // if the leaf is the left sentinal then create new node
+	    if (old_l->is_sentinal) {
+	      leaf* new_l = leaf_pool.new_obj(KV(k,v));
+	      (*ptr) = node_pool.new_obj(k, l, (node*) new_l);
+	      return true;
+	    }
+
+	    leaf* new_l = leaf_pool.new_init([=] (leaf* new_l) {
+		// first insert into a new block
+		int i=0;
+		for (;i < old_l->size && less(old_l->keyvals[i].key, k); i++) {
+		  new_l->keyvals[i] = old_l->keyvals[i];
+		}
+		int offset = 0;
+		if (i == old_l->size || less(k, old_l->keyvals[i].key)) {
+		  new_l->keyvals[i] = KV(k,v);
+		  offset = 1;
+		}
+		if (offset == 0) {std::cout << "ouch" << std::endl; abort();}
+		for (; i < old_l->size ; i++ )
+		  new_l->keyvals[i+offset] = old_l->keyvals[i];
+		new_l->size = old_l->size + offset;
+	      });
+
+	    // if the block overlflows, split into two blocks and
+	    // create a parent
+	    if (new_l->size > block_size) {
+	      int size_l = new_l->size/2;
+	      int size_r = new_l->size - size_l;
+	      leaf* new_ll = leaf_pool.new_init([=] (leaf* new_ll) {
+		  for (int i =0 ; i < size_l; i++)
+		    new_ll->keyvals[i] = new_l->keyvals[i];
+		  new_ll->size = size_l;
+		});
+	      leaf* new_lr = leaf_pool.new_init([=] (leaf* new_lr) {
+		  for (int i =0 ; i < size_r; i++)
+		    new_lr->keyvals[i] = new_l->keyvals[i + size_l];
+		  new_lr->size = size_r;
+		});
+	      (*ptr) = node_pool.new_obj(new_l->keyvals[size_l].key,
+					 (node*) new_ll, (node*) new_lr);
+	      leaf_pool.retire(new_l);
+	    } else (*ptr) = (node*) new_l;
+
+	    // retire the old block
+	    leaf_pool.retire(old_l);
+	    return true;
+	  })) {
+	//if (balanced) balance.rebalance(p, root, k);
+	counts.increment();
+	return true;
+      }
+      // try again if unsuccessful
+    }
+  }
+
   bool insert(const K& k, const V& v) {
-    return verlib::with_epoch([=] {
-      while (true) {
-	auto [gp, gp_left, p, p_left, l] = find_location(root, k);
-	leaf* old_l = (leaf*) l;
-	if (old_l->find(k).has_value()) return false; // already there
-	if (p->try_lock([=] {
-	      auto ptr = (p_left) ? &(p->left) : &(p->right);
+    return verlib::with_epoch([=] {return insert_(k, v);});}
 
-	      // if p has been removed, or l has changed, then exit
+  // Removes a key from the leaf.  If the leaf will become empty by
+  // removing it, then both the leaf and its parent need to be deleted.
+  bool remove_(const K& k) {
+    while (true) {
+      auto [gp, gp_left, p, p_left, l] = find_location(root, k);
+      leaf* old_l = (leaf*) l;
+      if (!old_l->find(k).has_value()) return false; // not there
+      // The leaf has at least 2 keys, so the key can be removed from the leaf
+      if (old_l->size > 1) {
+	if (p->try_lock([=] {
+	      auto ptr = p_left ? &(p->left) : &(p->right);
 	      if (p->removed.load() || ptr->load() != l) return false;
-	      // if the leaf is the left sentinal then create new node
-	      if (old_l->is_sentinal) {
-		leaf* new_l = leaf_pool.new_obj(KV(k,v));
-		(*ptr) = node_pool.new_obj(k, l, (node*) new_l);
-		return true;
-	      }
-
 	      leaf* new_l = leaf_pool.new_init([=] (leaf* new_l) {
-		  // first insert into a new block
-		  int i=0;
-		  for (;i < old_l->size && less(old_l->keyvals[i].key, k); i++) {
+		  // copy into new node while deleting k, if there
+		  int i = 0;
+		  for (;i < old_l->size && old_l->keyvals[i].key < k; i++)
 		    new_l->keyvals[i] = old_l->keyvals[i];
-		  }
-		  int offset = 0;
-		  if (i == old_l->size || less(k, old_l->keyvals[i].key)) {
-		    new_l->keyvals[i] = KV(k,v);
-		    offset = 1;
-		  }
-		  if (offset == 0) {std::cout << "ouch" << std::endl; abort();}
-		  for (; i < old_l->size ; i++ )
-		    new_l->keyvals[i+offset] = old_l->keyvals[i];
-		  new_l->size = old_l->size + offset;
+		  int offset = equal(old_l->keyvals[i].key, k) ? 1 : 0;
+		  for (; i+offset < old_l->size ; i++ )
+		    new_l->keyvals[i] = old_l->keyvals[i+offset];
+		  new_l->size = i;
 		});
 
-	      // if the block overlflows, split into two blocks and
-	      // create a parent
-	      if (new_l->size > block_size) {
-		int size_l = new_l->size/2;
-		int size_r = new_l->size - size_l;
-		leaf* new_ll = leaf_pool.new_init([=] (leaf* new_ll) {
-		    for (int i =0 ; i < size_l; i++)
-		      new_ll->keyvals[i] = new_l->keyvals[i];
-		    new_ll->size = size_l;
-		  });
-		leaf* new_lr = leaf_pool.new_init([=] (leaf* new_lr) {
-		    for (int i =0 ; i < size_r; i++)
-		      new_lr->keyvals[i] = new_l->keyvals[i + size_l];
-		    new_lr->size = size_r;
-		  });
-		(*ptr) = node_pool.new_obj(new_l->keyvals[size_l].key,
-					   (node*) new_ll, (node*) new_lr);
-		leaf_pool.retire(new_l);
-	      } else (*ptr) = (node*) new_l;
-
-	      // retire the old block
+	      // update parent to point to new leaf, and retire old
+	      (*ptr) = (node*) new_l;
 	      leaf_pool.retire(old_l);
 	      return true;
 	    })) {
-	  //if (balanced) balance.rebalance(p, root, k);
+	  counts.decrement();
 	  return true;
 	}
-	// try again if unsuccessful
-      }
-    });
-  }
-  bool insert_(const K& k, const V& v) {return false;} // nyi
-
-  // Removes a key from the leaf.  If the leaf will become empty by
-  // removing it, then both the leaf and its parent need to be deleted.
-  bool remove(const K& k) {
-    return verlib::with_epoch([=] {
-      while (true) {
-	auto [gp, gp_left, p, p_left, l] = find_location(root, k);
-	leaf* old_l = (leaf*) l;
-	if (!old_l->find(k).has_value()) return false; // not there
-	// The leaf has at least 2 keys, so the key can be removed from the leaf
-	if (old_l->size > 1) {
-	  if (p->try_lock([=] {
-		auto ptr = p_left ? &(p->left) : &(p->right);
-		if (p->removed.load() || ptr->load() != l) return false;
-		leaf* new_l = leaf_pool.new_init([=] (leaf* new_l) {
-		    // copy into new node while deleting k, if there
-		    int i = 0;
-		    for (;i < old_l->size && old_l->keyvals[i].key < k; i++)
-		      new_l->keyvals[i] = old_l->keyvals[i];
-		    int offset = equal(old_l->keyvals[i].key, k) ? 1 : 0;
-		    for (; i+offset < old_l->size ; i++ )
-		      new_l->keyvals[i] = old_l->keyvals[i+offset];
-		    new_l->size = i;
-		  });
-
-		// update parent to point to new leaf, and retire old
-		(*ptr) = (node*) new_l;
-		leaf_pool.retire(old_l);
-		return true;
-	      }))
-	    return true;
 
-	  // The leaf has 1 key.  
-	} else if (equal(old_l->keyvals[0].key, k)) { // check the one key matches k
-
-	  // We need to delete the leaf (l) and its parent (p), and point
-	  // the granparent (gp) to the other child of p.
-	  if (gp->try_lock([=] {
-	      auto ptr = gp_left ? &(gp->left) : &(gp->right);
-
-	      // if p has been removed, or l has changed, then exit
-	      if (gp->removed.load() || ptr->load() != p) return false;
-
-	      // lock p and remove p and l
-	      return p->try_lock([=] {
-		  node* ll = (p->left).load();
-		  node* lr = (p->right).load();
-		  if (p_left) std::swap(ll,lr);
-		  if (lr != l) return false;
-		  p->removed = true;
-		  (*ptr) = ll; // shortcut
-		  node_pool.retire(p);
-		  leaf_pool.retire((leaf*) l);
-		  return true; });}))
-	    return true;
-	} else return true;
-	// try again if unsuccessful
-      }
-    });
+	// The leaf has 1 key.  
+      } else if (equal(old_l->keyvals[0].key, k)) { // check the one key matches k
+
+	// We need to delete the leaf (l) and its parent (p), and point
+	// the granparent (gp) to the other child of p.
+	if (gp->try_lock([=] {
+	    auto ptr = gp_left ? &(gp->left) : &(gp->right);
+
+	    // if p has been removed, or l has changed, then exit
+	    if (gp->removed.load() || ptr->load() != p) return false;
+
+	    // lock p and remove p and l
+	    return p->try_lock([=] {
+		node* ll = (p->left).load();
+		node* lr = (p->right).load();
+		if (p_left) std::swap(ll,lr);
+		if (lr != l) return false;
+		p->removed = true;
+		(*ptr) = ll; // shortcut
+		node_pool.retire(p);
+		leaf_pool.retire((leaf*) l);
+		return true; });})) {
+	  counts.decrement();
+	  return true;
+	}
+      } else return true;
+      // try again if unsuccessful
+    }
   }
 
-  bool remove_(const K& k) { return false;} // nyi
+  bool remove(const K& k) {
+    return verlib::with_epoch([=] {return remove_(k);});}
 
   std::optional<V> find_(const K& k) {
     auto [gp, gp_left, p, p_left, l] = find_location(root, k);
@@ -238,6 +245,122 @@ struct ordered_map {
   std::optional<V> find(const K& k) {
     return verlib::with_epoch([&] { return find_(k);});
   }
+
+  // add(k, v) can return false to stop the range query early
+  template<typename AddF>
+  static bool call_add(AddF& add, const K& k, const V& v) {
+    if constexpr (std::is_same_v<std::invoke_result_t<AddF&, const K&, const V&>, bool>)
+      return add(k, v);
+    else {add(k, v); return true;}
+  }
+
+  // Visits keys from start to end (both inclusive) in ascending or
+  // descending order.  A null start or end means unbounded.  Returns
+  // false if stopped early or aborted.
+  template<typename AddF>
+  static bool range_internal(node* p, AddF& add, const K* start, const K* end,
+                             bool ascending) {
+    if (p->is_leaf) {
+      leaf* l = (leaf*) p;
+      for (int j = 0; j < l->size; j++) {
+        KV& kv = l->keyvals[ascending ? j : l->size - 1 - j];
+        if (start != nullptr && less(kv.key, *start)) {
+          if (ascending) continue; else break;}
+        if (end != nullptr && less(*end, kv.key)) {
+          if (ascending) break; else continue;}
+        if (!call_add(add, kv.key, kv.value)) return false;
+#ifdef LazyStamp
+        if (verlib::aborted) return false;
+#endif
+      }
+      return true;
+    }
+    // keys less than p->key are on the left
+    bool go_left = start == nullptr || less(*start, p->key);
+    bool go_right = end == nullptr || !less(*end, p->key);
+    node* first = ascending ? p->left.load() : p->right.load();
+    node* second = ascending ? p->right.load() : p->left.load();
+    if ((ascending ? go_left : go_right) &&
+        !range_internal(first, add, start, end, ascending))
+      return false;
+    return !(ascending ? go_right : go_left) ||
+      range_internal(second, add, start, end, ascending);
+  }
+
+  template<typename AddF>
+  void range_(AddF& add, const K& start, const K& end) {
+    range_internal(root->left.load(), add, &start, &end, true);
+  }
+
+  // same keys as range_, but largest first
+  template<typename AddF>
+  void range_desc_(AddF& add, const K& start, const K& end) {
+    range_internal(root->left.load(), add, &start, &end, false);
+  }
+
+  // The first (up to) n key-values with keys not less than start.
+  parlay::sequence<std::pair<K,V>> range_limit_(const K& start, size_t n) {
+    parlay::sequence<std::pair<K,V>> out;
+    if (n == 0) return out;
+    auto add = [&] (const K& k, const V& v) {
+      out.push_back(std::pair(k, v));
+      return out.size() < n;};
+    range_internal(root->left.load(), add, &start, nullptr, true);
+    return out;
+  }
+
+  parlay::sequence<std::pair<K,V>> range_limit(const K& start, size_t n) {
+    return verlib::with_snapshot([&] {return range_limit_(start, n);});
+  }
+
+  // The last (up to) n key-values with keys not greater than from,
+  // largest first.
+  parlay::sequence<std::pair<K,V>> range_desc_limit_(const K& from, size_t n) {
+    parlay::sequence<std::pair<K,V>> out;
+    if (n == 0) return out;
+    auto add = [&] (const K& k, const V& v) {
+      out.push_back(std::pair(k, v));
+      return out.size() < n;};
+    range_internal(root->left.load(), add, nullptr, &from, false);
+    return out;
+  }
+
+  parlay::sequence<std::pair<K,V>> range_desc_limit(const K& from, size_t n) {
+    return verlib::with_snapshot([&] {return range_desc_limit_(from, n);});
+  }
+
+  // A cursor over a snapshot taken now, starting at start, which returns
+  // key-values in batches in ascending (or descending) order (see
+  // verlib/cursor.h)
+  using cursor_t = verlib::cursor<ordered_map, K, V>;
+  cursor_t cursor(const K& start) {return cursor_t(*this, start);}
+  cursor_t cursor_desc(const K& start) {return cursor_t(*this, start, true);}
+
+  // Batched versions that run the whole batch inside one epoch
+  // announcement.  out[i] is set to the result for keys[i], and the
+  // updates return the number that succeeded.
+  template <typename Keys, typename Out>
+  void multi_find(const Keys& keys, Out& out) {
+    verlib::with_epoch([&] {
+      for (size_t i = 0; i < keys.size(); i++) out[i] = find_(keys[i]);});
+  }
+
+  template <typename KVs>
+  long multi_insert(const KVs& kvs) {
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < kvs.size(); i++)
+        cnt += insert_(kvs[i].first, kvs[i].second);
+      return cnt;});
+  }
+
+  template <typename Keys>
+  long multi_remove(const Keys& keys) {
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < keys.size(); i++) cnt += remove_(keys[i]);
+      return cnt;});
+  }
   
   node* empty() {
     leaf* l = leaf_pool.new_obj();
@@ -273,6 +396,9 @@ struct ordered_map {
     return hrec(root->left.load(), 1);
   }
   
+  // number of keys, exact when no updates are in progress
+  long size() {return counts.get();}
+
   long check() {
     using rtup = std::tuple<K,K,long>;
     std::function<rtup(node*)> crec;
@@ -328,9 +454,11 @@ struct ordered_map {
     leaf_pool.clear();
   }
 
+  // leaves are split in half when they overflow, and there is about
+  // one node per leaf
   static void reserve(size_t n) {
-    node_pool.reserve(n/8);
-    leaf_pool.reserve(n);
+    node_pool.reserve(2 * n / block_size + 1);
+    leaf_pool.reserve(2 * n / block_size + 1);
   }
 
   static void shuffle(size_t n) {
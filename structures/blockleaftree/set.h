@@ -1 +1,2 @@
+#define Range_Search 1
 #include "ordered_map.h"
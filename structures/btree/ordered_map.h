@@ -1,13 +1,50 @@
 #include <verlib/verlib.h>
+#include <verlib/overwrites.h>
+#include <verlib/cursor.h>
 #include <parlay/primitives.h>
+#include <verlib/key_search.h>
+#include <verlib/size_counter.h>
 
 // A top-down implementation of abtrees
 // Nodes are split or joined on the way down to ensure that each node
 // can fit one more child, or remove one more child.
 
+// Sizes in bytes of leaves and internal nodes.  Larger leaves help
+// lookups and range queries, smaller ones make the copy on each
+// update cheaper.
+template <int LeafBytes, int NodeBytes>
+struct btree_sizes {
+  static constexpr int leaf_bytes = LeafBytes;
+  static constexpr int node_bytes = NodeBytes;
+};
+
+// Picks sizes from the key and value sizes: room for about 28
+// key-values in a leaf and 20 children in a node, rounded up to whole
+// cache lines plus one line for the header.  Leaves are capped at 16
+// lines so large values do not make updates too expensive.  For 8 byte
+// keys and values this gives 8 line leaves and 6 line nodes.  Can be
+// overridden at compile time with BtreeLeafBytes and BtreeNodeBytes.
+template <typename K, typename V, int CacheLine = 64>
+struct btree_default_sizes {
+  static constexpr int lines(size_t bytes) {
+    return 1 + (int) ((bytes + CacheLine - 1) / CacheLine);}
+#ifdef BtreeLeafBytes
+  static constexpr int leaf_bytes = BtreeLeafBytes;
+#else
+  static constexpr int leaf_bytes =
+    CacheLine * std::min(16, lines(28 * (sizeof(K) + sizeof(V))));
+#endif
+#ifdef BtreeNodeBytes
+  static constexpr int node_bytes = BtreeNodeBytes;
+#else
+  static constexpr int node_bytes = CacheLine * lines(20 * (sizeof(K) + 8));
+#endif
+};
+
 template <typename K,
       typename V,
-      typename Compare = std::less<K>>
+      typename Compare = std::less<K>,
+      typename Sizes = btree_default_sizes<K,V>>
 struct ordered_map {
   static constexpr auto less = Compare{};
   struct KV {K key; V value;};
@@ -15,6 +52,7 @@ struct ordered_map {
   struct leaf;
   struct node;
   node* root;
+  verlib::size_counter counts; // number of keys, see size()
   enum Status : char { isOver, isUnder, OK};
 
   struct header : verlib::versioned {
@@ -27,13 +65,16 @@ struct ordered_map {
       : is_leaf(is_leaf), status(status), removed(false), size(size) {}
   };
 
-  static constexpr int leaf_block_bytes = 64 * 8;
-  static constexpr int kv_bytes = leaf_block_bytes - sizeof(header);
+  static constexpr int leaf_block_bytes = Sizes::leaf_bytes;
+  using overwrites = verlib::overwrites<V>;
+  using ow_list = typename overwrites::rec*;
+  static constexpr int kv_bytes = leaf_block_bytes - sizeof(header) - sizeof(overwrites);
+  static_assert(kv_bytes > 0, "btree leaf_bytes too small");
   static constexpr int leaf_block_size = std::max(kv_bytes/sizeof(KV), 5ul);
   static constexpr int leaf_min_size = leaf_block_size/5;
   static constexpr int leaf_join_cutoff = leaf_min_size * 4;
 
-  static constexpr int node_block_bytes = 64 * 6;
+  static constexpr int node_block_bytes = Sizes::node_bytes;
   static constexpr int entry_bytes = node_block_bytes - sizeof(header) - sizeof(verlib::lock) + sizeof(K);
   static constexpr int node_block_size = std::max(entry_bytes/(sizeof(K) + 8), 5ul);
   static constexpr int node_min_size = node_block_size/5;
@@ -54,6 +95,8 @@ struct ordered_map {
     int find(const K& k, int i=0) {
       //while (i < header::size-1 && !less(k, keys[i])) i++;
       //return i;
+      if constexpr (key_search::vectorized<K, Compare, sizeof(K)>)
+        return std::max(i, key_search::count<K, true, sizeof(K)>(keys, header::size-1, k));
       if (header::size == 1) return 0;
       int mid = (header::size-1)/2;
       if (less(k, keys[mid])) // first half
@@ -213,9 +256,13 @@ struct ordered_map {
   // Leafs
   // ***************************************
 
-  // Leafs are immutable.  Once created and the keyvals set, their values
-  // will not be changed.
+  // Leafs are immutable other than the overwrites.  Once created and
+  // the keyvals set, they will not be changed, but an upsert of a key
+  // that is already present adds an overwrite (under the lock of the
+  // parent) instead of copying the leaf, up to leaf_max_overwrites of
+  // them.  Any copy of the leaf folds the overwrites in.
   struct alignas(64) leaf : header {
+    overwrites ow;
     KV keyvals[leaf_block_size];
     
     std::optional<V> find(const K& k) {
@@ -228,12 +275,20 @@ struct ordered_map {
       //     i = mid+1;
       //     while (i < header::size && less(keyvals[i].key, k)) i++;
       // }
-      while (i < header::size && less(keyvals[i].key, k)) i++;
+      i = prev(k);
       if (i == header::size || less(k, keyvals[i].key)) return {};
-      else return keyvals[i].value;
+      else return overwrites::get(ow.load(), i, keyvals[i].value);
     }
 
+    // the key-value at i with the overwrites o applied, o from ow.load()
+    KV get(int i, ow_list o) {
+      return KV{keyvals[i].key, overwrites::get(o, i, keyvals[i].value)};
+    }
+
+    // first position at or after i whose key is not less than k
     int prev(const K& k, int i=0) {
+      if constexpr (key_search::vectorized<K, Compare, sizeof(KV)>)
+        return std::max(i, key_search::count<K, false, sizeof(KV)>(&keyvals[0].key, header::size, k));
       while (i < header::size && less(keyvals[i].key, k)) i++;
       return i;
     }
@@ -245,12 +300,19 @@ struct ordered_map {
   };
 
   static verlib::memory_pool<leaf> leaf_pool;
+  static constexpr int leaf_max_overwrites = 4;
+
+  static void retire_leaf(leaf* l) {
+    l->ow.retire();
+    leaf_pool.retire(l);
+  }
 
   static leaf* copy_leaf(leaf* l) {
     int size = l->size;
+    ow_list o = l->ow.load();
     leaf* new_l = leaf_pool.new_init([=] (leaf* new_l) {
     for (int i=0; i < size; i++)
-      new_l->keyvals[i] = l->keyvals[i];}, size);
+      new_l->keyvals[i] = l->get(i, o);}, size);
     return new_l;
   }
 
@@ -258,6 +320,7 @@ struct ordered_map {
   // Old is left intact (but retired).
   // The key k must not already be present in the leaf.
   static leaf* insert_leaf(leaf* l, const K& k, const V& v, bool upsert=false) {
+    ow_list o = l->ow.load();
     return leaf_pool.new_init([=] (leaf* new_l) {
       int size = l->size;
       assert(size < leaf_block_size);
@@ -265,7 +328,7 @@ struct ordered_map {
 
       // copy part before the new key
       for (;i < size && less(l->keyvals[i].key, k); i++)
-        new_l->keyvals[i] = l->keyvals[i];
+        new_l->keyvals[i] = l->get(i, o);
 
       // copy in the new key and value
       new_l->keyvals[i] = KV{k,v};
@@ -275,11 +338,11 @@ struct ordered_map {
           // can only happen when upserting
           i++;
           for (; i < size ; i++ )
-            new_l->keyvals[i] = l->keyvals[i];
+            new_l->keyvals[i] = l->get(i, o);
         } else {
           // copy the part after the new key
           for (; i < size ; i++ )
-            new_l->keyvals[i+1] = l->keyvals[i];
+            new_l->keyvals[i+1] = l->get(i, o);
         }
       }
     }, (upsert ? l->size : l->size + 1));
@@ -288,6 +351,7 @@ struct ordered_map {
   // Remove a key-value pair from the leaf that matches the key k.
   // This copies the values into a new leaf.
   static leaf* remove_leaf(leaf* l, const K& k) {
+    ow_list o = l->ow.load();
     return leaf_pool.new_init([=] (leaf* new_l) {
     int size = l->size;
     assert(size > 0);
@@ -295,11 +359,11 @@ struct ordered_map {
 
     // part before the key
     for (;i < size && less(l->keyvals[i].key, k); i++)
-      new_l->keyvals[i] = l->keyvals[i];
+      new_l->keyvals[i] = l->get(i, o);
 
     // part after the key, shifted left
     for (; i < size-1 ; i++ )
-      new_l->keyvals[i] = l->keyvals[i+1];}, l->size - 1);
+      new_l->keyvals[i] = l->get(i+1, o);}, l->size - 1);
   }
 
   // helper function for split_leaf and rebalance_leaf
@@ -356,25 +420,30 @@ struct ordered_map {
     leaf* l = (leaf*) p;
     int size = l->size;
     assert(size == leaf_block_size);
-    auto result = split_mid_leaf(size, [=] (int i) {return l->keyvals[i];});
+    ow_list o = l->ow.load();
+    auto result = split_mid_leaf(size, [=] (int i) {return l->get(i, o);});
     return result;
   }
 
   static std::tuple<node*,K,node*> rebalance_leaf(node* l, node* r) {
     int size = l->size + r->size;
+    ow_list lo = ((leaf*) l)->ow.load();
+    ow_list ro = ((leaf*) r)->ow.load();
     auto result = split_mid_leaf(size, [=] (int i) {
-         if (i < l->size) return ((leaf*) l)->keyvals[i];
-     else return ((leaf*) r)->keyvals[i - l->size];});
+         if (i < l->size) return ((leaf*) l)->get(i, lo);
+     else return ((leaf*) r)->get(i - l->size, ro);});
     return result;
   }
 
   static node* join_leaf(node* l, node* r) {
     int size = l->size + r->size;
+    ow_list lo = ((leaf*) l)->ow.load();
+    ow_list ro = ((leaf*) r)->ow.load();
     return (node*) leaf_pool.new_init([=] (leaf* new_l) {
     for (int i=0; i < l->size + r->size; i++)
       new_l->keyvals[i] = ((i < l->size) 
-                   ? ((leaf*) l)->keyvals[i] 
-                   : ((leaf*) r)->keyvals[i - l->size]);}, size);
+                   ? ((leaf*) l)->get(i, lo)
+                   : ((leaf*) r)->get(i - l->size, ro));}, size);
   }
 
   // ***************************************
@@ -395,7 +464,7 @@ struct ordered_map {
         if (c->is_leaf) {
           gp->children[pidx] = add_child(p, split_leaf(c), cidx);
           p->removed = true;
-          leaf_pool.retire((leaf*) c);
+          retire_leaf((leaf*) c);
           node_pool.retire(p);
           return true;
         }
@@ -430,8 +499,8 @@ struct ordered_map {
             gp->children[pidx] = rebalance_children(p, rebalance_leaf(lc, rc), li);
           p->removed = true;
           node_pool.retire(p);
-          leaf_pool.retire((leaf*) lc);
-          leaf_pool.retire((leaf*) rc);
+          retire_leaf((leaf*) lc);
+          retire_leaf((leaf*) rc);
           return true;
         } else { // internal node
           // K& k = p->keys[li];
@@ -470,7 +539,7 @@ struct ordered_map {
   static node* copy_node_or_leaf(node* p) {
     if (p->is_leaf) {
       node* r = (node*) copy_leaf((leaf*) p);
-      leaf_pool.retire((leaf*) p);
+      retire_leaf((leaf*) p);
       return r;
     } else {
       node* r = copy_node(p);
@@ -492,7 +561,7 @@ struct ordered_map {
     if (c->status == isOver) {
       if (c->is_leaf) {
         root->children[0] = node_pool.new_obj(split_leaf(c));
-        leaf_pool.retire((leaf*) c);
+        retire_leaf((leaf*) c);
       } else {
         root->children[0] = node_pool.new_obj(split(c));
         node_pool.retire(c);
@@ -521,12 +590,17 @@ struct ordered_map {
   // overfull nodes, and joining underfull nodes with a neighbor).
   // This ensures that the returned leaf is not full, and that it is safe
   // to split a child along the way since its parent is not full and can
-  // absorb an extra pointer
-  static std::tuple<node*, int, leaf*> find_and_fix(node* root, const K& k) {
+  // absorb an extra pointer.
+  // If upper is given it is set to the smallest key on the path that is
+  // greater than k, i.e. the exclusive upper bound of the keys that
+  // belong in the returned leaf (empty if the leaf is the last one).
+  static std::tuple<node*, int, leaf*> find_and_fix(node* root, const K& k,
+                                                    std::optional<K>* upper = nullptr) {
     int cnt = 0;
     while (true) {
       node* p = root;
       int cidx = 0;
+      if (upper) *upper = std::nullopt;
       node* c = p->children[cidx].load();
       if (c->status == isOver || (!c->is_leaf && c->size == 1))
         fix_root(root, c);
@@ -536,6 +610,7 @@ struct ordered_map {
           int pidx = cidx;
           p = c;
           cidx = c->find(k);
+          if (upper && cidx < p->size-1) *upper = p->keys[cidx];
           c = p->children[cidx].load();
           // The following two lines are only useful if hardware
           // prefetching is turned off.  They prefetch the next two
@@ -576,32 +651,84 @@ struct ordered_map {
   // tries again.
   // returns false and does no update if already in tree
   bool insert_(const K& k, const V& v) {
-    return flck::try_loop([&] {return try_insert(k, v);});}
+    bool r = !flck::try_loop([&] {
+      return try_apply(k, [=] (const std::optional<V>&) {return v;}, true, false);});
+    if (r) counts.increment();
+    return r;}
   
   bool insert(const K& k, const V& v) {
     return verlib::with_epoch([=] {return insert_(k, v);}); }
 
   bool upsert_(const K& k, const V& v) {
-    return flck::try_loop([&] {return try_insert(k, v, true);});}
+    if (!flck::try_loop([&] {
+	  return try_apply(k, [=] (const std::optional<V>&) {return v;}, true, true);}))
+      counts.increment();
+    return true;}
   
   bool upsert(const K& k, const V& v) {
     return verlib::with_epoch([=] {return upsert_(k, v);}); }
 
-  std::optional<bool> try_insert(const K& k, const V& v, const bool upsert=false) {
+  // Read-modify-write versions.  upsert sets the value of k to
+  // f(std::optional<V>(old)) if present, or f(std::optional<V>()) if
+  // not, and returns true if k was inserted.  update sets the value to
+  // f(old) only if present, and returns whether it was.
+  template <typename F,
+            typename = std::enable_if_t<std::is_invocable_v<F, std::optional<V>>>>
+  bool upsert_(const K& k, const F& f) {
+    bool r = !flck::try_loop([&] {return try_apply(k, f, true, true);});
+    if (r) counts.increment();
+    return r;}
+
+  template <typename F,
+            typename = std::enable_if_t<std::is_invocable_v<F, std::optional<V>>>>
+  bool upsert(const K& k, const F& f) {
+    return verlib::with_epoch([&] {return upsert_(k, f);}); }
+
+  template <typename F>
+  bool update_(const K& k, const F& f) {
+    return flck::try_loop([&] {
+      return try_apply(k, [f] (const std::optional<V>& v) {return f(*v);}, false, true);});}
+
+  template <typename F>
+  bool update(const K& k, const F& f) {
+    return verlib::with_epoch([&] {return update_(k, f);}); }
+
+  // Shared by insert, upsert and update.  If k is present and
+  // replace_if_present, replaces its value with f(std::optional<V>(old)),
+  // in place if the leaf has room for another overwrite.  If k is not
+  // present and insert_if_absent, inserts it with f(std::optional<V>()).
+  // Returns whether k was present, or empty if the lock failed.
+  // f is applied inside the lock, so with lock-free locks it can be
+  // applied more than once and should have no side effects.
+  template <typename F>
+  std::optional<bool> try_apply(const K& k, const F& f,
+                                bool insert_if_absent, bool replace_if_present) {
     auto [p, cidx, l] = verlib::do_now([&] {return find_and_fix(root, k);});
-    if (!upsert && l->find(k).has_value()) { // already there
+    int i = l->prev(k);
+    bool found = i < l->size && !less(k, l->keyvals[i].key);
+    if (found ? !replace_if_present : !insert_if_absent) { // nothing to do
       if (p->lck.read_lock([&] {
              return (p->children[cidx].load() == (node*) l) && !p->removed.load();}))
-        return false;
+        return found;
       else return {};
     }
     else if (p->lck.try_lock([=] {
       if (p->removed.load() || (leaf*) p->children[cidx].load() != l)
         return false;
-      bool upsert_leaf = upsert && l->find(k).has_value();
-      p->children[cidx] = (node*) insert_leaf(l, k, v, upsert_leaf);
-      leaf_pool.retire(l);
-      return true;})) return true;
+      ow_list o = l->ow.load();
+      if (!found) {
+        p->children[cidx] = (node*) insert_leaf(l, k, f(std::optional<V>()));
+        retire_leaf(l);
+        return true;
+      }
+      V v = f(std::optional<V>(overwrites::get(o, i, l->keyvals[i].value)));
+      if (overwrites::size(o) < leaf_max_overwrites)
+        l->ow.add(o, i, v);  // overwrite the value in place
+      else {
+        p->children[cidx] = (node*) insert_leaf(l, k, v, true);
+        retire_leaf(l);
+      }
+      return true;})) return found;
     else return {};
   }
 
@@ -611,7 +738,9 @@ struct ordered_map {
   // changed.  If the try_lock fails it tries again.  Returns false if
   // not found.
   bool remove_(const K& k) {
-    return flck::try_loop([&] {return try_remove(k);});}
+    bool r = flck::try_loop([&] {return try_remove(k);});
+    if (r) counts.decrement();
+    return r;}
 
   bool remove(const K& k) {
     return verlib::with_epoch([=] { return remove_(k);});}
@@ -627,32 +756,141 @@ struct ordered_map {
           if (p->removed.load() || (leaf*) p->children[cidx].load() != l)
         return false;
           p->children[cidx] = (node*) remove_leaf(l, k);
-          leaf_pool.retire(l);
+          retire_leaf(l);
           return true;})) return true;
     else return {};
   }
 
+  // Applies a batch of updates sorted by key with no duplicate keys.
+  // Each update is a pair of a key and an optional value: with a value
+  // it is an upsert, and without one a remove.  The batch is cut into
+  // blocks that run in parallel.  Within a block the updates that fall
+  // in the same leaf are merged into a single new leaf under one lock
+  // on the parent, so a leaf is copied once rather than once per key.
+  // A leaf is only given as many updates as keep it from becoming over
+  // or underfull, the rest go to the next round, after find_and_fix
+  // has split or joined it.
+  // Returns the net change in the number of keys.
+  template <typename Batch>
+  long multi_update(const Batch& batch) {
+    size_t n = batch.size();
+    size_t block_size = std::max<size_t>(256, n / (8 * parlay::num_workers()));
+    size_t num_blocks = (n + block_size - 1) / block_size;
+    auto deltas = parlay::tabulate(num_blocks, [&] (size_t b) {
+      return verlib::with_epoch([&] {
+        size_t e = std::min(n, (b + 1) * block_size);
+        long cnt = 0;
+        for (size_t i = b * block_size; i < e;) {
+          auto [next, delta] = flck::try_loop([&] {
+            return try_multi_update(batch, i, e);});
+          i = next;
+          cnt += delta;
+        }
+        counts.add(cnt);
+        return cnt;});}, 1);
+    return parlay::reduce(deltas);
+  }
+
+  // Applies a prefix of batch[i,end) that falls in one leaf.  Returns
+  // the end of the prefix and the change in the number of keys, or
+  // empty if the lock failed.
+  template <typename Batch>
+  std::optional<std::pair<size_t,long>>
+  try_multi_update(const Batch& batch, size_t i, size_t end) {
+    std::optional<K> upper;
+    auto [p, cidx, l] = verlib::do_now([&] {
+      return find_and_fix(root, batch[i].first, &upper);});
+    int size = l->size;
+    int li = 0;
+    long delta = 0;
+    bool changed = false;
+    size_t j = i;
+    while (j < end && (!upper.has_value() || less(batch[j].first, *upper))) {
+      const K& k = batch[j].first;
+      li = l->prev(k, li);
+      bool present = li < l->size && !less(k, l->keyvals[li].key);
+      int d = batch[j++].second.has_value() ? !present : -(int) present;
+      changed = changed || d != 0 || present;
+      size += d;
+      delta += d;
+      if (size == leaf_block_size || (d < 0 && size == leaf_min_size)) break;
+    }
+    if (!changed) { // only removes of missing keys
+      if (p->lck.read_lock([&] {
+            return (p->children[cidx].load() == (node*) l) && !p->removed.load();}))
+        return std::pair(j, delta);
+      else return {};
+    }
+    const Batch* b = &batch;
+    if (p->lck.try_lock([=] {
+          if (p->removed.load() || (leaf*) p->children[cidx].load() != l)
+            return false;
+          p->children[cidx] = (node*) merge_leaf(l, *b, i, j, size);
+          retire_leaf(l);
+          return true;})) return std::pair(j, delta);
+    else return {};
+  }
+
+  // Copies a leaf merged with the sorted updates batch[s,e), which must
+  // all belong in the leaf, into a new leaf with the given size.
+  template <typename Batch>
+  static leaf* merge_leaf(leaf* l, const Batch& batch, size_t s, size_t e, int size) {
+    const Batch* b = &batch;
+    ow_list o = l->ow.load();
+    return leaf_pool.new_init([=] (leaf* new_l) {
+      int i = 0, k = 0;
+      for (size_t j = s; j < e; j++) {
+        auto& [key, val] = (*b)[j];
+        while (i < l->size && less(l->keyvals[i].key, key))
+          new_l->keyvals[k++] = l->get(i++, o);
+        if (i < l->size && !less(key, l->keyvals[i].key)) i++; // replaced
+        if (val.has_value()) new_l->keyvals[k++] = KV{key, *val};
+      }
+      while (i < l->size) new_l->keyvals[k++] = l->get(i++, o);
+      assert(k == size);}, size);
+  }
+
+  // add(k, v) can return false to stop the range query early
   template<typename AddF>
-  static bool range_internal(node* a, AddF& add, const K& start, const K& end) {
+  static bool call_add(AddF& add, const K& k, const V& v) {
+    if constexpr (std::is_same_v<std::invoke_result_t<AddF&, const K&, const V&>, bool>)
+      return add(k, v);
+    else {add(k, v); return true;}
+  }
+
+  // Visits keys from start (inclusive) to end (exclusive, or
+  // inclusive if end_inclusive) in ascending or descending order.  A
+  // null start or end means unbounded.  Returns false if stopped early
+  // or aborted.
+  template<typename AddF>
+  static bool range_internal(node* a, AddF& add, const K* start, const K* end,
+                             bool ascending = true, bool end_inclusive = false) {
     while (true) {
       if (a->is_leaf) {
     leaf* la = (leaf*) a;
-    int s = la->prev(start, 0);
-    int e = la->prev(end, s);
-    for (int i = s; i < e; i++) {
-      add(la->keyvals[i].key, la->keyvals[i].value);
+    int s = (start == nullptr) ? 0 : la->prev(*start, 0);
+    int e = (end == nullptr) ? la->size : la->prev(*end, s);
+    if (end_inclusive && end != nullptr && e < la->size
+        && !less(*end, la->keyvals[e].key)) e++;
+    ow_list o = la->ow.load();
+    for (int j = 0; j < e - s; j++) {
+      int i = ascending ? s + j : e - 1 - j;
+      if (!call_add(add, la->keyvals[i].key, overwrites::get(o, i, la->keyvals[i].value)))
+        return false;
 #ifdef LazyStamp
       if (verlib::aborted) return false;
 #endif
     }
     return true;
       }
-      int s = a->find(start);
-      int e = a->find(end, s);
+      int s = (start == nullptr) ? 0 : a->find(*start);
+      int e = (end == nullptr) ? a->size-1 : a->find(*end, s);
       if (s == e) a = a->children[s].read_snapshot();
       else {
-    for (int i = s; i <= e; i++) {
-      if (!range_internal(a->children[i].read_snapshot(), add, start, end))
+    for (int j = 0; j <= e - s; j++) {
+      int i = ascending ? s + j : e - j;
+      if (!range_internal(a->children[i].read_snapshot(), add, start, end,
+                          ascending, end_inclusive))
         return false;
     }
     return true;
@@ -662,9 +900,117 @@ struct ordered_map {
 
   template<typename AddF>
   void range_(AddF& add, const K& start, const K& end) {
-      range_internal(root, add, start, end);
+      range_internal(root, add, &start, &end);
   }
 
+  // same keys as range_, but largest first
+  template<typename AddF>
+  void range_desc_(AddF& add, const K& start, const K& end) {
+      range_internal(root, add, &start, &end, false);
+  }
+
+  // The first (up to) n key-values with keys not less than start.
+  // Costs O(n) beyond the descent rather than the size of a window.
+  parlay::sequence<std::pair<K,V>> range_limit_(const K& start, size_t n) {
+    parlay::sequence<std::pair<K,V>> out;
+    if (n == 0) return out;
+    auto add = [&] (const K& k, const V& v) {
+      out.push_back(std::pair(k, v));
+      return out.size() < n;};
+    range_internal(root, add, &start, nullptr);
+    return out;
+  }
+
+  parlay::sequence<std::pair<K,V>> range_limit(const K& start, size_t n) {
+    return verlib::with_snapshot([&] {return range_limit_(start, n);});
+  }
+
+  // The last (up to) n key-values with keys not greater than from,
+  // largest first.
+  parlay::sequence<std::pair<K,V>> range_desc_limit_(const K& from, size_t n) {
+    parlay::sequence<std::pair<K,V>> out;
+    if (n == 0) return out;
+    auto add = [&] (const K& k, const V& v) {
+      out.push_back(std::pair(k, v));
+      return out.size() < n;};
+    range_internal(root, add, nullptr, &from, false, true);
+    return out;
+  }
+
+  parlay::sequence<std::pair<K,V>> range_desc_limit(const K& from, size_t n) {
+    return verlib::with_snapshot([&] {return range_desc_limit_(from, n);});
+  }
+
+  // A cursor over a snapshot taken now, starting at start, which returns
+  // key-values in batches in ascending (or descending) order (see
+  // verlib/cursor.h)
+  using cursor_t = verlib::cursor<ordered_map, K, V>;
+  cursor_t cursor(const K& start) {return cursor_t(*this, start);}
+  cursor_t cursor_desc(const K& start) {return cursor_t(*this, start, true);}
+
+  // Ordered queries.  lower_bound finds the first key not less than
+  // k, successor the first key greater than k, and predecessor the
+  // last key less than k.  The versions with an underscore can be used
+  // inside a snapshot (or on their own, but then they are not atomic
+  // if they cross leaves), the others take their own snapshot.
+  using kv_opt = std::optional<std::pair<K,V>>;
+
+  // first in the subtree a with key >= k (> k if strict), or the
+  // smallest if k is null
+  static kv_opt next_internal(node* a, const K* k, bool strict) {
+    if (a->is_leaf) {
+      leaf* l = (leaf*) a;
+      int i = 0;
+      if (k != nullptr) {
+        i = l->prev(*k);
+        if (strict && i < l->size && !less(*k, l->keyvals[i].key)) i++;
+      }
+      if (i == l->size) return {};
+      KV kv = l->get(i, l->ow.load());
+      return std::pair(kv.key, kv.value);
+    }
+    // children after the first one only have keys greater than k
+    for (int i = (k == nullptr) ? 0 : a->find(*k); i < a->size; i++) {
+      kv_opt r = next_internal(a->children[i].load(), k, strict);
+      if (r.has_value()) return r;
+      k = nullptr;
+    }
+    return {};
+  }
+
+  // last in the subtree a with key < k, or the largest if k is null
+  static kv_opt prev_internal(node* a, const K* k) {
+    if (a->is_leaf) {
+      leaf* l = (leaf*) a;
+      int i = (k == nullptr) ? l->size : l->prev(*k);
+      if (i == 0) return {};
+      KV kv = l->get(i-1, l->ow.load());
+      return std::pair(kv.key, kv.value);
+    }
+    // children before the first one only have keys less than k
+    for (int i = (k == nullptr) ? a->size-1 : a->find(*k); i >= 0; i--) {
+      kv_opt r = prev_internal(a->children[i].load(), k);
+      if (r.has_value()) return r;
+      k = nullptr;
+    }
+    return {};
+  }
+
+  kv_opt lower_bound_(const K& k) {return next_internal(root, &k, false);}
+  kv_opt successor_(const K& k) {return next_internal(root, &k, true);}
+  kv_opt predecessor_(const K& k) {return prev_internal(root, &k);}
+  kv_opt min_() {return next_internal(root, nullptr, false);}
+  kv_opt max_() {return prev_internal(root, nullptr);}
+
+  kv_opt lower_bound(const K& k) {
+    return verlib::with_snapshot([&] {return lower_bound_(k);});}
+  kv_opt successor(const K& k) {
+    return verlib::with_snapshot([&] {return successor_(k);});}
+  kv_opt predecessor(const K& k) {
+    return verlib::with_snapshot([&] {return predecessor_(k);});}
+  kv_opt min() {return verlib::with_snapshot([&] {return min_();});}
+  kv_opt max() {return verlib::with_snapshot([&] {return max_();});}
+
   std::optional<std::optional<V>> try_find(const K& k) {
     using ot = std::optional<std::optional<V>>;
     auto [p, cidx, l] = find_no_fix(root, k);
@@ -687,6 +1033,58 @@ struct ordered_map {
     return verlib::with_epoch([&] {return find_(k);});
   }
 
+  // Batched versions that run the whole batch inside one epoch
+  // announcement.  out[i] is set to the result for keys[i], and the
+  // updates return the number that succeeded.
+  // multi_find_ descends a group of keys at a time one level per step,
+  // prefetching each key's next node so that the misses of the group
+  // overlap.
+  template <typename Keys, typename Out>
+  void multi_find_(const Keys& keys, Out& out) {
+    constexpr int group = 16;
+    size_t n = keys.size();
+    for (size_t s = 0; s < n; s += group) {
+      int m = std::min<size_t>(group, n - s);
+      node* c[group];
+      for (int j = 0; j < m; j++) c[j] = root->children[0].load();
+      bool at_leaves = false;
+      while (!at_leaves) {
+        at_leaves = true;
+        for (int j = 0; j < m; j++)
+          if (!c[j]->is_leaf) {
+            c[j] = c[j]->children[c[j]->find(keys[s+j])].load();
+            __builtin_prefetch (((char*) c[j]));
+            __builtin_prefetch (((char*) c[j]) + 64);
+            __builtin_prefetch (((char*) c[j]) + 128);
+            at_leaves = false;
+          }
+      }
+      for (int j = 0; j < m; j++) out[s+j] = ((leaf*) c[j])->find(keys[s+j]);
+    }
+  }
+
+  template <typename Keys, typename Out>
+  void multi_find(const Keys& keys, Out& out) {
+    verlib::with_epoch([&] {multi_find_(keys, out);});
+  }
+
+  template <typename KVs>
+  long multi_insert(const KVs& kvs) {
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < kvs.size(); i++)
+        cnt += insert_(kvs[i].first, kvs[i].second);
+      return cnt;});
+  }
+
+  template <typename Keys>
+  long multi_remove(const Keys& keys) {
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < keys.size(); i++) cnt += remove_(keys[i]);
+      return cnt;});
+  }
+
   // An empty tree is an empty leaf along with a root pointing tho the
   // leaf.  The root will always contain a single pointer.
   ordered_map() : root(node_pool.new_obj(leaf_pool.new_obj(0))) {
@@ -698,10 +1096,51 @@ struct ordered_map {
     // std::cout << "value size: " << sizeof(V) << std::endl;
   }
 
+  // Builds a tree from key-value pairs that are sorted by key and have
+  // no duplicates.  Builds bottom up in parallel, one level at a time.
+  // Leaves and nodes are filled evenly to one short of full so they are
+  // neither underfull nor overfull, and the first insert into each does
+  // not need a split.
+  ordered_map(const parlay::sequence<KV>& sorted) : root(build(sorted)) {
+    counts.add(sorted.size());
+  }
+
+  static node* build(const parlay::sequence<KV>& sorted) {
+    size_t n = sorted.size();
+    if (n == 0) return node_pool.new_obj(leaf_pool.new_obj(0));
+
+    // the leaves, and the smallest key in each
+    size_t num_leaves = (n + leaf_block_size - 2) / (leaf_block_size - 1);
+    auto level = parlay::tabulate(num_leaves, [&] (size_t i) {
+      size_t s = i * n / num_leaves;
+      size_t e = (i + 1) * n / num_leaves;
+      return (node*) leaf_pool.new_init([&] (leaf* l) {
+        for (size_t j = s; j < e; j++) l->keyvals[j-s] = sorted[j];}, e - s);});
+    auto mins = parlay::tabulate(num_leaves, [&] (size_t i) {
+      return sorted[i * n / num_leaves].key;});
+
+    // each level of internal nodes, separated by the smallest key
+    // of the child to the right
+    while (level.size() > 1) {
+      size_t m = level.size();
+      size_t num_nodes = (m + node_block_size - 2) / (node_block_size - 1);
+      auto next = parlay::tabulate(num_nodes, [&] (size_t i) {
+        size_t s = i * m / num_nodes;
+        size_t e = (i + 1) * m / num_nodes;
+        return copy(e - s,
+                    [&] (int j) {return mins[s + j + 1];},
+                    [&] (int j) {return level[s + j];});});
+      mins = parlay::tabulate(num_nodes, [&] (size_t i) {
+        return mins[i * m / num_nodes];});
+      level = std::move(next);
+    }
+    return node_pool.new_obj((leaf*) level[0]);
+  }
+
   static void retire_recursive(node* p) {
     if (p == nullptr) return;
     if (p->is_leaf) {
-      leaf_pool.retire((leaf*) p);
+      retire_leaf((leaf*) p);
     } else {
       for(int i = 0; i < p->size; i++)
         retire_recursive(p->children[i].load());
@@ -757,6 +1196,9 @@ struct ordered_map {
     return rtup(std::get<0>(r[0]),std::get<1>(r[r.size()-1]), total);
   }
 
+  // number of keys, exact when no updates are in progress
+  long size() {return counts.get();}
+
   long check(bool verbose=false) {
     auto [minv, maxv, cnt] = check_recursive(root->children[0].load(), true);
     if (verbose) std::cout << "average height = "
@@ -788,9 +1230,12 @@ struct ordered_map {
     leaf_pool.clear();
   }
 
+  // leaves and nodes for n keys, taking each to be filled half way
+  // between its minimum and block size
   static void reserve(size_t n) {
-    node_pool.reserve(n);
-    leaf_pool.reserve(n);
+    size_t leaves = n / ((leaf_min_size + leaf_block_size) / 2) + 1;
+    leaf_pool.reserve(leaves);
+    node_pool.reserve(leaves / ((node_min_size + node_block_size) / 2) + 1);
   }
 
   static void shuffle(size_t n) {
@@ -805,8 +1250,8 @@ struct ordered_map {
 
 };
 
-template <typename K, typename V, typename C>
-verlib::memory_pool<typename ordered_map<K,V,C>::node> ordered_map<K,V,C>::node_pool;
+template <typename K, typename V, typename C, typename S>
+verlib::memory_pool<typename ordered_map<K,V,C,S>::node> ordered_map<K,V,C,S>::node_pool;
 
-template <typename K, typename V, typename C>
-verlib::memory_pool<typename ordered_map<K,V,C>::leaf> ordered_map<K,V,C>::leaf_pool;
+template <typename K, typename V, typename C, typename S>
+verlib::memory_pool<typename ordered_map<K,V,C,S>::leaf> ordered_map<K,V,C,S>::leaf_pool;
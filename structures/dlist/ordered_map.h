@@ -58,6 +58,67 @@ struct ordered_map {
   bool insert(const K& k, const V& v) {
     return verlib::with_epoch([=] {return insert_(k, v);}); }
 
+  // Read-modify-write upsert and update, as in btree.
+  template <typename F,
+            typename = std::enable_if_t<std::is_invocable_v<F, std::optional<V>>>>
+  bool upsert_(const K& k, const F& f) {
+    return !flck::try_loop([&] {return try_apply(k, f, true);});}
+
+  template <typename F,
+            typename = std::enable_if_t<std::is_invocable_v<F, std::optional<V>>>>
+  bool upsert(const K& k, const F& f) {
+    return verlib::with_epoch([&] {return upsert_(k, f);}); }
+
+  bool upsert(const K& k, const V& v) {
+    return upsert(k, [=] (const std::optional<V>&) {return v;}); }
+
+  template <typename F>
+  bool update_(const K& k, const F& f) {
+    return flck::try_loop([&] {
+      return try_apply(k, [f] (const std::optional<V>& v) {return f(*v);}, false);});}
+
+  template <typename F>
+  bool update(const K& k, const F& f) {
+    return verlib::with_epoch([&] {return update_(k, f);}); }
+
+  // As in btree, but a present key's node is replaced by a copy,
+  // locking the node and its predecessor as in remove.
+  template <typename F>
+  std::optional<bool> try_apply(const K& k, const F& f, bool insert_if_absent) {
+    node* loc = find_location(root, k);
+    node* prev = (loc->prev).load();
+    if (loc->is_end || less(k, loc->key)) { // not found
+      if (!insert_if_absent)
+        if (prev->lck.read_lock([&] {return ((prev->next.load() == loc) &&
+                                             !prev->removed.load());}))
+          return false;
+        else return {};
+      if ((prev->is_end || prev->key < k) &&
+          prev->try_lock([=] {
+            if (!prev->removed.load() && (prev->next).load() == loc) {
+              node* new_node = flck::New<node>(k, f(std::optional<V>()), loc, prev);
+              prev->next = new_node;
+              loc->prev = new_node;
+              return true;
+            } else return false;})) return false;
+      else return {};
+    }
+    if (prev->try_lock([=] {
+        if (prev->removed.load() || (prev->next).load() != loc)
+	  return false;
+	return loc->try_lock([=] {
+         node* next = (loc->next).load();
+         node* new_node = flck::New<node>(k, f(std::optional<V>(loc->value)), next, prev);
+	 loc->removed = true;
+	 prev->next = new_node;
+	 next->prev = new_node;
+	 flck::Retire<node>(loc);
+	return true;
+        });}))
+      return true;
+    else return {};
+  }
+
   std::optional<bool> try_remove(const K& k) {
     node* loc = find_location(root, k);
     node* prev = (loc->prev).load();
@@ -113,6 +174,32 @@ struct ordered_map {
     return verlib::with_epoch([&] {return find_(k);});
   }
 
+  // Batched versions that run the whole batch inside one epoch
+  // announcement.  out[i] is set to the result for keys[i], and the
+  // updates return the number that succeeded.
+  template <typename Keys, typename Out>
+  void multi_find(const Keys& keys, Out& out) {
+    verlib::with_epoch([&] {
+      for (size_t i = 0; i < keys.size(); i++) out[i] = find_(keys[i]);});
+  }
+
+  template <typename KVs>
+  long multi_insert(const KVs& kvs) {
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < kvs.size(); i++)
+        cnt += insert_(kvs[i].first, kvs[i].second);
+      return cnt;});
+  }
+
+  template <typename Keys>
+  long multi_remove(const Keys& keys) {
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < keys.size(); i++) cnt += remove_(keys[i]);
+      return cnt;});
+  }
+
   template<typename AddF>
   void range_(AddF& add, const K& start, const K& end) {
     node* next = (root->next).load();
@@ -178,7 +265,7 @@ struct ordered_map {
   }
 
   static void clear() { flck::clear_pool<node>();}
-  //static void reserve(size_t n) { node_pool.reserve(n);}
+  static void reserve(size_t n) {} // node_pool.reserve(n);}
   static void shuffle(size_t n) {} // node_pool.shuffle(n);}
   static void stats() { flck::pool_stats<node>();}
 
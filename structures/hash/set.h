@@ -59,6 +59,36 @@ struct Set {
     else return {};
   }
 
+  // Finds for a batch of keys in one epoch, setting out[i] to the
+  // result for keys[i].  Works on groups of multi_find_group keys in
+  // stages so the cache misses within a group overlap: hashes the keys
+  // and prefetches the slots, then prefetches the first node of each
+  // slot, then searches.
+  static constexpr int multi_find_group = 16;
+
+  template <typename Keys, typename Out>
+  void multi_find(Table& table, const Keys& keys, Out& out) {
+    size_t n = keys.size();
+    verlib::with_epoch([&] {
+      slot* slots[multi_find_group];
+      for (size_t i = 0; i < n; i += multi_find_group) {
+	int m = std::min<size_t>(multi_find_group, n - i);
+	for (int j = 0; j < m; j++) {
+	  slots[j] = get_slot(table, keys[i+j]);
+	  __builtin_prefetch (slots[j]);
+	}
+	for (int j = 0; j < m; j++)
+	  __builtin_prefetch (slots[j]->head.read());
+	for (int j = 0; j < m; j++) {
+	  auto [cur, nxt] = find_in_slot(slots[j], keys[i+j]);
+	  cur->validate();
+	  if (nxt != nullptr) out[i+j] = nxt->value;
+	  else out[i+j] = std::nullopt;
+	}
+      }
+      return true;});
+  }
+
   bool insert_at(slot* s, const K& k, const V& v) {
     while (true) {
       unsigned int vn = s->version_num.load();
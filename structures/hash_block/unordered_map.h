@@ -3,15 +3,24 @@
 
 // A lock free concurrent unordered_map using a hash table
 // Supports: fast atomic insert, upsert, remove, and  find
-// along with a non-atomic, and slow, size
+// along with a size kept by per worker counts
 // Each bucket points to a structure (Node) containing an array of entries
 // Nodes come in varying sizes and on update the node is copied.
-// Allows arbitrary growing, but only efficient if not much larger
-// than the original given size (i.e. number of buckets is fixes, but
-// number of entries per bucket can grow).
+// The table doubles when the number of entries exceeds twice the
+// number of buckets.  The resize is incremental: the new table starts
+// with every bucket unmigrated, and each old bucket is moved (split in
+// two) under its lock, either when an update needs one of its new
+// buckets or one at a time by each update.  Finds on an unmigrated
+// bucket read the old table.  The table pointer is versioned, and a
+// bucket is moved by first storing the new buckets and then marking
+// the old one forwarded, so a snapshot sees each key in exactly one of
+// the two tables.  With UseCAS there are no bucket locks and the table
+// does not grow.
 
 #include <parlay/primitives.h>
 #include <verlib/verlib.h>
+#include <verlib/key_search.h>
+#include <verlib/size_counter.h>
 
 template <typename K,
 	  typename V,
@@ -21,129 +30,146 @@ struct unordered_map {
 private:
   struct KV {K key; V value;};
 
-  template <typename Range>
-  static int find_in_range(const Range& entries, long cnt, const K& k) {
-    for (int i=0; i < cnt; i++)
-      if (KeyEqual{}(entries[i].key, k)) return i;
-    return -1;
-  }
-
-  // The following three functions copy a range and
-  // insert/update/remove the specified key.  No ordering is assumed
-  // within the range.  Insert assumes k does not appear, while
-  // update/remove assume it does appear.
-  template <typename Range, typename RangeIn>
-  static void copy_and_insert(Range& out, const RangeIn& entries, long cnt, const K& k, const V& v) {
-    for (int i=0; i < cnt; i++) out[i] = entries[i];
-    out[cnt] = KV{k,v};
-  }
-
-  template <typename Range, typename RangeIn, typename F>
-  static void copy_and_update(Range& out, const RangeIn& entries, long cnt, const K& k, const F& f) {
-    int i = 0;
-    while (!KeyEqual{}(k, entries[i].key) && i < cnt) {
-      assert(i < cnt);
-      out[i] = entries[i];
-      i++;
-    }
-    out[i].key = entries[i].key;
-    out[i].value = f(entries[i].value);
-    i++;
-    while (i < cnt) {
-      out[i] = entries[i];
-      i++;
-    }
-  }
-
-  template <typename Range, typename RangeIn>
-  static void copy_and_remove(Range& out, const RangeIn& entries, long cnt, const K& k) {
-    int i = 0;
-    while (!KeyEqual{}(k, entries[i].key)) {
-      assert(i < cnt);
-      out[i] = entries[i];
-      i++;
-    }
-    while (i < cnt-1) {
-      out[i] = entries[i+1];
-      i++;
+  // The hash is mixed by a multiply so its high bits depend on all of
+  // it, since the low bits pick the bucket.  The top byte is the tag
+  // and the next 24 bits pick the children in big nodes.
+  static size_t mix(size_t h) {return h * 0x9E3779B97F4A7C15ul;}
+  static unsigned char get_tag(size_t h) {
+    return (unsigned char) (mix(h) >> 56);}
+  static int digit(size_t h, int depth) {
+    return (mix(h) >> (52 - 4 * depth)) & 15;}
+
+  // index of k among the n entries, comparing keys only where the tag
+  // matches, or -1 if not found
+  static int find_tagged(const KV* e, const unsigned char* t, int n,
+			 const K& k, unsigned char tag) {
+    for (int i=0; i < n; i += 64) {
+      uint64_t m = key_search::match_bytes(t + i, std::min(n - i, 64), tag);
+      for (; m != 0; m &= m - 1) {
+	int j = i + __builtin_ctzll(m);
+	if (KeyEqual{}(e[j].key, k)) return j;
+      }
     }
+    return -1;
   }
 
   // Each bucket points to a Node of some Size, or to a BigNode (defined below)
   // A node contains an array of up to Size entries (actual # of entries given by cnt)
   // Sizes are 1, 3, 7, 31
+  // Each entry has a tag (fingerprint) in an array before the entries,
+  // and keys are only compared where the tag matches.  The tags take 8
+  // bytes in nodes of up to 7 entries (matched as one word) and 32 in
+  // Node<31> (matched with SSE2).  Which layout a node has is given by
+  // its cnt.
   template <int Size>
   struct Node : verlib::versioned {
     using node = Node<0>;
     int cnt;
+    unsigned char tags[Size <= 7 ? 8 : 32];
     KV entries[Size];
 
+    KV* get_entries() {
+      if (cnt <= 7) return ((Node<7>*) this)->entries;
+      else return ((Node<31>*) this)->entries;
+    }
+
+    unsigned char* get_tags() {
+      if (cnt <= 7) return ((Node<7>*) this)->tags;
+      else return ((Node<31>*) this)->tags;
+    }
+
     // return index of key in entries, or -1 if not found
-    int find_index(const K& k) {
-      if (cnt <= 31) return find_in_range(entries, cnt, k);
-      else return find_in_range(((BigNode*) this)->entries, cnt, k);
+    int find_index(const K& k, unsigned char tag) {
+      return find_tagged(get_entries(), get_tags(), cnt, k, tag);
     }
 
     // return optional value found in entries given a key
-    std::optional<V> find(const K& k) {
-      if (cnt <= 31) { // regular node
-	if (KeyEqual{}(entries[0].key, k)) // shortcut for common case
-	   return entries[0].value;
-	int i = find_in_range(entries+1, cnt-1, k);
-	if (i == -1) return {};
-	else return entries[i].value;
-      } else { // big node
-	int i = find_in_range(((BigNode*) this)->entries, cnt, k);
-	if (i == -1) return {};
-	else return ((BigNode*) this)->entries[i].value;
+    std::optional<V> find(const K& k, unsigned char tag) {
+      int i = find_index(k, tag);
+      if (i == -1) return {};
+      else return get_entries()[i].value;
+    }
+
+    Node() : cnt(0) {}
+
+    // from the given entries
+    Node(const KV* e, const unsigned char* t, int n) : cnt(n) {
+      for (int i=0; i < n; i++) {
+	entries[i] = e[i];
+	tags[i] = t[i];
       }
     }
 
     // copy and insert
-    Node(node* old, const K& k, const V& v) {
+    Node(node* old, const K& k, const V& v, unsigned char tag) {
       cnt = (old == nullptr) ? 1 : old->cnt + 1;
-      copy_and_insert(entries, old->entries, cnt-1, k, v);
+      copy_entries(entries, tags, old);
+      entries[cnt-1] = KV{k,v};
+      tags[cnt-1] = tag;
     }
 
-    // copy and update
+    // copy and update entry i
     template <typename F>
-    Node(node* old, const K& k, const F& f) : cnt(old->cnt) {
-      assert(old != nullptr);
-      copy_and_update(entries, old->entries, cnt, k, f);
+    Node(node* old, int i, const F& f) : cnt(old->cnt) {
+      copy_entries(entries, tags, old);
+      entries[i].value = f(entries[i].value);
     }
 
-    // copy and remove
-    Node(node* old, const K& k) : cnt(old->cnt - 1) {
-      if (cnt == 31) copy_and_remove(entries, ((BigNode*) old)->entries, cnt+1, k);
-      else copy_and_remove(entries, old->entries, cnt+1, k);
+    // copy and remove entry i
+    Node(node* old, int i) : cnt(old->cnt - 1) {
+      copy_entries(entries, tags, old, i);
     }
   };
   using node = Node<0>;
 
-  // If a node overflows (cnt > 31), then it becomes a big node and its content
-  // is stored indirectly in a parlay sequence.
+  // copies the entries and tags of old, skipping position skip
+  static void copy_entries(KV* e, unsigned char* t, node* old, int skip = -1) {
+    if (old == nullptr) return;
+    KV* old_e = old->get_entries();
+    unsigned char* old_t = old->get_tags();
+    for (int i=0, j=0; i < old->cnt; i++)
+      if (i != skip) {
+	e[j] = old_e[i];
+	t[j++] = old_t[i];
+      }
+  }
+
+  // If a node overflows (cnt > 31), then it becomes a big node.  To
+  // keep updates from copying the whole bucket, big nodes form a
+  // persistent trie on the mixed hash: each has 16 children picked by
+  // 4 bits of the hash, and an update copies the path to its leaf.
+  // Children are big nodes or ordinary nodes (or null), and cnt is the
+  // number of entries below, always more than 31.  At max_depth the
+  // hash bits are used up, and the (colliding) entries are instead
+  // stored in a vector, with tags padded to a multiple of 16.
+  static constexpr int max_depth = 6;
+
   struct BigNode : verlib::versioned {
-    using entries_type = std::vector<KV>;
     int cnt;
-    entries_type entries;
+    int depth;
+    node* children[16];
+    std::vector<unsigned char> tags;
+    std::vector<KV> entries;
+
+    // with the given children
+    BigNode(int n, int depth, node** c) : cnt(n), depth(depth) {
+      for (int i=0; i < 16; i++) children[i] = c[i];
+    }
 
-    // copy and insert
-    BigNode(node* old, const K& k, const V& v) : cnt(old->cnt + 1) {
-      entries = entries_type(cnt);
-      if (old->cnt == 31) copy_and_insert(entries, old->entries, old->cnt, k, v);
-      else copy_and_insert(entries, ((BigNode*) old)->entries, old->cnt, k, v);
+    // at max_depth, with the given entries
+    BigNode(int n, const KV* e, const unsigned char* t)
+      : cnt(n), depth(max_depth), tags((n + 15) & ~15), entries(e, e+n) {
+      for (int i=0; i < 16; i++) children[i] = nullptr;
+      for (int i=0; i < n; i++) tags[i] = t[i];
     }
 
-    // copy and update
-    template <typename F>
-    BigNode(node* old, const K& k, const F& f) : cnt(old->cnt) {
-      entries = entries_type(cnt);
-      copy_and_update(entries, ((BigNode*) old)->entries, cnt, k, f);  }
-
-    // copy and remove
-    BigNode(node* old, const K& k) : cnt(old->cnt - 1) {
-      entries = entries_type(cnt);
-      copy_and_remove(entries, ((BigNode*) old)->entries, cnt+1, k); }
+    bool is_leaf() {return depth == max_depth;}
+
+    node* child(size_t h) {return children[digit(h, depth)];}
+
+    int find_index(const K& k, unsigned char tag) {
+      return find_tagged(entries.data(), tags.data(), cnt, k, tag);
+    }
   };
 
   // structure for each bucket
@@ -154,25 +180,75 @@ private:
   {
     node* load() {return ptr.load();}
     verlib::versioned_ptr<node> ptr;
-    bucket() : ptr(nullptr) {}
+    bucket(node* x = nullptr) : ptr(x) {}
   };
 
 
-  struct Table {
-    std::vector<bucket> table;
+  // Buckets of a new table that have not been moved from the old one
+  // point to unmigrated(), and the old buckets that have been moved
+  // point to forwarded().  Both are empty nodes.
+  static node* unmigrated() {static node x; return &x;}
+  static node* forwarded() {static node x; return &x;}
+
+  struct Table : verlib::versioned {
+    bucket* table;
     size_t size;
-    bucket* get_bucket(const K& k) {
-      size_t idx = Hash{}(k)  & (size-1u);
-      return &table[idx];
+    Table* old;  // table being migrated from, if any
+    size_t old_size;
+    std::atomic<size_t> next_to_migrate;
+    std::atomic<size_t> num_migrated;
+
+    bucket* get_bucket(size_t h) {
+      return &table[h & (size-1u)];
     }
-    Table(size_t n) {
+
+    bool migrating() {
+      return old != nullptr && num_migrated.load() < old_size;}
+
+    Table(size_t n, node* init = nullptr, Table* old = nullptr)
+      : old(old), old_size(old == nullptr ? 0 : old->size),
+	next_to_migrate(0), num_migrated(0) {
       int bits = parlay::log2_up(n);
       size = 1ul << bits;
-      table = std::vector<bucket>(size);
+      table = std::allocator<bucket>().allocate(size);
+      parlay::parallel_for (0, size, [&] (size_t i) {
+	new (&table[i]) bucket(init);});
+    }
+
+    // a table of twice the size, with all buckets unmigrated
+    Table(Table* old) : Table(2 * old->size, unmigrated(), old) {}
+
+    ~Table() {
+      parlay::parallel_for (0, size, [&] (size_t i) {table[i].~bucket();});
+      std::allocator<bucket>().deallocate(table, size);
     }
   };
 
-  Table hash_table;
+  verlib::versioned_ptr<Table> table;
+
+  // The current bucket array, only used to prefetch a bucket before
+  // entering an epoch.  It can be stale, which is harmless for a
+  // prefetch.
+  std::atomic<bucket*> prefetch_buckets;
+  std::atomic<size_t> prefetch_mask;
+  void prefetch(size_t h) {
+    __builtin_prefetch (prefetch_buckets.load(std::memory_order_relaxed) +
+			(h & prefetch_mask.load(std::memory_order_relaxed)));
+  }
+  void set_prefetch(Table* t) {
+    prefetch_buckets = t->table;
+    prefetch_mask = t->size - 1u;
+  }
+#ifndef UseCAS
+  verlib::lock table_lock;
+#endif
+
+  // number of entries, exact when no updates are in progress
+  verlib::size_counter counts;
+
+  // a resize is considered when an insert leaves a bucket with more
+  // than this many entries
+  static constexpr int grow_bucket_cnt = 4;
 
   using Node1 = Node<1>;
   using Node3 = Node<3>;
@@ -183,49 +259,174 @@ private:
   static verlib::memory_pool<Node7> node_pool_7;
   static verlib::memory_pool<Node31> node_pool_31;
   static verlib::memory_pool<BigNode> big_node_pool;
+  static verlib::memory_pool<Table> table_pool;
+
+  static BigNode* big(node* x) {
+    return (x != nullptr && x->cnt > 31) ? (BigNode*) x : nullptr;}
+
+  // appends the entries below x to e and t
+  static void collect(node* x, std::vector<KV>& e, std::vector<unsigned char>& t) {
+    if (x == nullptr) return;
+    BigNode* b = big(x);
+    if (b == nullptr) {
+      e.insert(e.end(), x->get_entries(), x->get_entries() + x->cnt);
+      t.insert(t.end(), x->get_tags(), x->get_tags() + x->cnt);
+    } else if (b->is_leaf()) {
+      e.insert(e.end(), b->entries.begin(), b->entries.end());
+      t.insert(t.end(), b->tags.begin(), b->tags.begin() + b->cnt);
+    } else for (node* c : b->children) collect(c, e, t);
+  }
 
-  static node* insert_to_node(node* old, const K& k, const V& v) {
-    if (old == nullptr) return (node*) node_pool_1.new_obj(old, k, v);
-    if (old->cnt < 3) return (node*) node_pool_3.new_obj(old, k, v);
-    else if (old->cnt < 7) return (node*) node_pool_7.new_obj(old, k, v);
-    else if (old->cnt < 31) return (node*) node_pool_31.new_obj(old, k, v);
-    else return (node*) big_node_pool.new_obj(old, k, v);
+  // a node at the given depth holding the n entries.  Children are
+  // allocated before their parent so that each allocation is logged
+  // when run in a lock.
+  static node* new_node(const KV* e, const unsigned char* t, int n, int depth = 0) {
+    if (n == 0) return nullptr;
+    if (n == 1) return (node*) node_pool_1.new_obj(e, t, n);
+    if (n <= 3) return (node*) node_pool_3.new_obj(e, t, n);
+    else if (n <= 7) return (node*) node_pool_7.new_obj(e, t, n);
+    else if (n <= 31) return (node*) node_pool_31.new_obj(e, t, n);
+    else if (depth == max_depth) return (node*) big_node_pool.new_obj(n, e, t);
+    std::vector<KV> ce[16];
+    std::vector<unsigned char> ct[16];
+    for (int i=0; i < n; i++) {
+      int j = digit(Hash{}(e[i].key), depth);
+      ce[j].push_back(e[i]);
+      ct[j].push_back(t[i]);
+    }
+    node* c[16];
+    for (int j=0; j < 16; j++)
+      c[j] = new_node(ce[j].data(), ct[j].data(), ce[j].size(), depth + 1);
+    return (node*) big_node_pool.new_obj(n, depth, c);
+  }
+
+  // The following three return a copy of x with k (hashing to h)
+  // inserted, updated or removed.  Insert assumes k does not appear,
+  // while update/remove assume it does appear.  A big node copies the
+  // path to k, and others copy the whole node.
+  static node* insert_to_node(node* x, const K& k, const V& v, size_t h, int depth = 0) {
+    unsigned char tag = get_tag(h);
+    if (x == nullptr) return (node*) node_pool_1.new_obj(x, k, v, tag);
+    if (x->cnt < 3) return (node*) node_pool_3.new_obj(x, k, v, tag);
+    else if (x->cnt < 7) return (node*) node_pool_7.new_obj(x, k, v, tag);
+    else if (x->cnt < 31) return (node*) node_pool_31.new_obj(x, k, v, tag);
+    BigNode* b = big(x);
+    if (b == nullptr || b->is_leaf()) {
+      std::vector<KV> e;
+      std::vector<unsigned char> t;
+      collect(x, e, t);
+      e.push_back(KV{k,v});
+      t.push_back(tag);
+      return new_node(e.data(), t.data(), e.size(), depth);
+    }
+    node* c[16];
+    for (int i=0; i < 16; i++) c[i] = b->children[i];
+    int j = digit(h, b->depth);
+    c[j] = insert_to_node(c[j], k, v, h, b->depth + 1);
+    return (node*) big_node_pool.new_obj(b->cnt + 1, b->depth, c);
   }
 
   template <typename F>
-  static node* update_node(node* old, const K& k, const F& f) {
-    if (old->cnt == 1) return (node*) node_pool_1.new_obj(old, k, f);
-    if (old->cnt <= 3) return (node*) node_pool_3.new_obj(old, k, f);
-    else if (old->cnt <= 7) return (node*) node_pool_7.new_obj(old, k, f);
-    else if (old->cnt <= 31) return (node*) node_pool_31.new_obj(old, k, f);
-    else return (node*) big_node_pool.new_obj(old, k, f);
+  static node* update_node(node* x, const K& k, const F& f, size_t h) {
+    unsigned char tag = get_tag(h);
+    BigNode* b = big(x);
+    if (b == nullptr) {
+      int i = x->find_index(k, tag);
+      if (x->cnt == 1) return (node*) node_pool_1.new_obj(x, i, f);
+      if (x->cnt <= 3) return (node*) node_pool_3.new_obj(x, i, f);
+      else if (x->cnt <= 7) return (node*) node_pool_7.new_obj(x, i, f);
+      else return (node*) node_pool_31.new_obj(x, i, f);
+    }
+    if (b->is_leaf()) {
+      std::vector<KV> e = b->entries;
+      int i = b->find_index(k, tag);
+      e[i].value = f(e[i].value);
+      return (node*) big_node_pool.new_obj(b->cnt, e.data(), b->tags.data());
+    }
+    node* c[16];
+    for (int i=0; i < 16; i++) c[i] = b->children[i];
+    int j = digit(h, b->depth);
+    c[j] = update_node(c[j], k, f, h);
+    return (node*) big_node_pool.new_obj(b->cnt, b->depth, c);
   }
 
-  static node* remove_from_node(node* old, const K& k) {
-    if (old->cnt == 1) return (node*) nullptr;
-    if (old->cnt == 2) return (node*) node_pool_1.new_obj(old, k);
-    else if (old->cnt <= 4) return (node*) node_pool_3.new_obj(old, k);
-    else if (old->cnt <= 8) return (node*) node_pool_7.new_obj(old, k);
-    else if (old->cnt <= 32) return (node*) node_pool_31.new_obj(old, k);
-    else return (node*) big_node_pool.new_obj(old, k);
+  static node* remove_from_node(node* x, const K& k, size_t h) {
+    unsigned char tag = get_tag(h);
+    BigNode* b = big(x);
+    if (b == nullptr) {
+      int i = x->find_index(k, tag);
+      if (x->cnt == 1) return (node*) nullptr;
+      if (x->cnt == 2) return (node*) node_pool_1.new_obj(x, i);
+      else if (x->cnt <= 4) return (node*) node_pool_3.new_obj(x, i);
+      else if (x->cnt <= 8) return (node*) node_pool_7.new_obj(x, i);
+      else return (node*) node_pool_31.new_obj(x, i);
+    }
+    if (b->cnt == 32 || b->is_leaf()) {
+      std::vector<KV> e;
+      std::vector<unsigned char> t;
+      collect(x, e, t);
+      int i = find_tagged(e.data(), t.data(), e.size(), k, tag);
+      e.erase(e.begin() + i);
+      t.erase(t.begin() + i);
+      return new_node(e.data(), t.data(), e.size(), b->depth);
+    }
+    node* c[16];
+    for (int i=0; i < 16; i++) c[i] = b->children[i];
+    int j = digit(h, b->depth);
+    c[j] = remove_from_node(c[j], k, h);
+    return (node*) big_node_pool.new_obj(b->cnt - 1, b->depth, c);
   }
 
-  static void retire_node(node* old) {
-    if (old == nullptr);
-    else if (old->cnt == 1) node_pool_1.retire((Node1*) old);
-    else if (old->cnt <= 3) node_pool_3.retire((Node3*) old);
-    else if (old->cnt <= 7) node_pool_7.retire((Node7*) old);
-    else if (old->cnt <= 31) node_pool_31.retire((Node31*) old);
-    else big_node_pool.retire((BigNode*) old);
+  static void retire_one(node* x) {
+    if (x->cnt == 1) node_pool_1.retire((Node1*) x);
+    else if (x->cnt <= 3) node_pool_3.retire((Node3*) x);
+    else if (x->cnt <= 7) node_pool_7.retire((Node7*) x);
+    else if (x->cnt <= 31) node_pool_31.retire((Node31*) x);
+    else big_node_pool.retire((BigNode*) x);
   }
 
-  static void destruct_node(node* old) {
-    if (old == nullptr);
-    else if (old->cnt == 1) node_pool_1.destruct((Node1*) old);
-    else if (old->cnt <= 3) node_pool_3.destruct((Node3*) old);
-    else if (old->cnt <= 7) node_pool_7.destruct((Node7*) old);
-    else if (old->cnt <= 31) node_pool_31.destruct((Node31*) old);
-    else big_node_pool.destruct((BigNode*) old);
+  static void destruct_one(node* x) {
+    if (x->cnt == 1) node_pool_1.destruct((Node1*) x);
+    else if (x->cnt <= 3) node_pool_3.destruct((Node3*) x);
+    else if (x->cnt <= 7) node_pool_7.destruct((Node7*) x);
+    else if (x->cnt <= 31) node_pool_31.destruct((Node31*) x);
+    else big_node_pool.destruct((BigNode*) x);
+  }
+
+  // Applies f to the nodes below x that are not shared with y, the
+  // node in the same position of another version.  Copies share
+  // unchanged children in the same position, so this finds the nodes
+  // an update replaced (x old, y new) or created (x new, y old).
+  template <typename F>
+  static void for_each_unshared(node* x, node* y, const F& f) {
+    if (x == nullptr || x == y) return;
+    BigNode* bx = big(x);
+    if (bx != nullptr && !bx->is_leaf()) {
+      BigNode* by = big(y);
+      for (int i=0; i < 16; i++)
+	for_each_unshared(bx->children[i], by ? by->children[i] : nullptr, f);
+    }
+    f(x);
+  }
+
+  static void retire_node(node* x) {
+    for_each_unshared(x, nullptr, retire_one);}
+
+  static void retire_replaced(node* old_node, node* new_node) {
+    for_each_unshared(old_node, new_node, retire_one);}
+
+  static void destruct_new(node* new_node, node* old_node) {
+    for_each_unshared(new_node, old_node, destruct_one);}
+
+  // retires the nodes on the path to h, which are the ones an update
+  // replaces
+  static void retire_path(node* x, size_t h) {
+    while (x != nullptr) {
+      BigNode* b = big(x);
+      node* next = (b == nullptr || b->is_leaf()) ? nullptr : b->child(h);
+      retire_one(x);
+      x = next;
+    }
   }
 
   // try to install a new node in bucket s
@@ -240,16 +441,17 @@ private:
 	    return true;})) 
 #endif
     {
-      retire_node(old_node);
+      retire_replaced(old_node, new_node);
       return ret_val;
     } 
-    destruct_node(new_node);
+    destruct_new(new_node, old_node);
     return {};
   }
 
-  static std::optional<bool> try_insert_at(bucket* s, const K& k, const V& v) {
+  static std::optional<bool> try_insert_at(bucket* s, const K& k, const V& v, size_t h) {
     node* old_node = s->load();
-    if (old_node != nullptr && old_node->find_index(k) != -1) {
+    if (old_node == forwarded()) return {}; // table was replaced
+    if (find_at(old_node, k, h).has_value()) {
 #ifndef UseCAS
       if (s->read_lock([&] {return s->load() == old_node;})) return false;
       else return {};
@@ -257,32 +459,33 @@ private:
       return false;
 #endif
     }
-    return try_update(s, old_node, insert_to_node(old_node, k, v), true);
+    return try_update(s, old_node, insert_to_node(old_node, k, v, h), true);
   }
 
   template <typename F>
-  static std::optional<bool> try_upsert_at(bucket* s, const K& k, F& f) {
+  static std::optional<bool> try_upsert_at(bucket* s, const K& k, F& f, size_t h) {
     node* old_node = s->load();
-    bool found = old_node != nullptr && old_node->find_index(k) != -1;
-    if (!found)
-      return try_update(s, old_node, insert_to_node(old_node, k, f(std::optional<V>())), true);
+    if (old_node == forwarded()) return {};
+    if (!find_at(old_node, k, h).has_value())
+      return try_update(s, old_node, insert_to_node(old_node, k, f(std::optional<V>()), h), true);
     else
 #ifdef UseCAS
-    return try_update(s, old_node, update_node(old_node, k, f), false);
+    return try_update(s, old_node, update_node(old_node, k, f, h), false);
 #else  // use try_lock
     if (s->try_lock([=] {
         if (s->load() != old_node) return false;
-	s->ptr = update_node(old_node, k, f); // f applied within lock
+	s->ptr = update_node(old_node, k, f, h); // f applied within lock
 	return true;})) {
-      retire_node(old_node);
+      retire_path(old_node, h);
       return false;
     } else return {};
 #endif
   }
 
-  static std::optional<bool> try_remove_at(bucket* s, const K& k) {
+  static std::optional<bool> try_remove_at(bucket* s, const K& k, size_t h) {
     node* old_node = s->load();
-    if (old_node == nullptr || old_node->find_index(k) == -1) {
+    if (old_node == forwarded()) return {};
+    if (!find_at(old_node, k, h).has_value()) {
 #ifndef UseCAS
       if (s->read_lock([&] {return s->load() == old_node;})) return false;
       else return {};
@@ -290,108 +493,333 @@ private:
       return false;
 #endif
     }
-    return try_update(s, old_node, remove_from_node(old_node, k), true);
+    return try_update(s, old_node, remove_from_node(old_node, k, h), true);
   }
 
   // find a key at the given bucket
-  static std::optional<V> find_at(node* x, const K& k) {
+  static std::optional<V> find_at(node* x, const K& k, size_t h) {
+    unsigned char tag = get_tag(h);
+    for (BigNode* b = big(x); b != nullptr; b = big(x)) {
+      if (b->is_leaf()) {
+	int i = b->find_index(k, tag);
+	if (i == -1) return {};
+	else return b->entries[i].value;
+      }
+      x = b->child(h);
+    }
     if (x == nullptr) return std::nullopt;
-    return x->find(k);
+    return x->find(k, tag);
+  }
+
+  // the node for the bucket of hash h in t, read from the old table if
+  // the bucket has not been migrated
+  static node* load_node(Table* t, size_t h) {
+    node* x = t->get_bucket(h)->load();
+    while (x == unmigrated()) {
+      x = t->old->get_bucket(h)->load();
+      if (x != forwarded()) break;
+      x = t->get_bucket(h)->load();
+    }
+    return x;
+  }
+
+  // Moves old bucket i into buckets i and i + old_size of t.  The new
+  // buckets are only written here, under the old bucket's lock, and
+  // are stored before the old one is marked as forwarded.  Returns
+  // once the bucket has been moved, by this or another call.
+  void migrate(Table* t, size_t i) {
+#ifndef UseCAS
+    bucket* s = &t->old->table[i];
+    bucket* lo = &t->table[i];
+    bucket* hi = &t->table[i + t->old_size];
+    size_t bit = t->old_size;
+    while (true) {
+      node* x = s->load();
+      if (x == forwarded()) return;
+      if (s->try_lock([=] {
+	    if (s->load() != x) return false;
+	    std::vector<KV> e, l, h;
+	    std::vector<unsigned char> tg, lt, ht;
+	    collect(x, e, tg);
+	    for (size_t j=0; j < e.size(); j++)
+	      if (Hash{}(e[j].key) & bit) {
+		h.push_back(e[j]);
+		ht.push_back(tg[j]);
+	      } else {
+		l.push_back(e[j]);
+		lt.push_back(tg[j]);
+	      }
+	    lo->ptr = new_node(l.data(), lt.data(), l.size());
+	    hi->ptr = new_node(h.data(), ht.data(), h.size());
+	    s->ptr = forwarded();
+	    return true;})) {
+	retire_node(x);
+	if (t->num_migrated.fetch_add(1) + 1 == t->old_size)
+	  table_pool.retire(t->old);
+	return;
+      }
+    }
+#endif
+  }
+
+  // each update moves one bucket of an incomplete resize
+  void help_migrate(Table* t) {
+    if (t->next_to_migrate.load() >= t->old_size) return;
+    size_t i = t->next_to_migrate.fetch_add(1);
+    if (i < t->old_size) migrate(t, i);
+  }
+
+  // the bucket for hash h in the current table t, migrated if needed
+  bucket* update_bucket(size_t h, Table*& t) {
+    t = table.load();
+    bucket* s = t->get_bucket(h);
+    if (s->load() == unmigrated())
+      migrate(t, h & (t->old_size - 1u));
+    return s;
+  }
+
+  std::optional<V> find_hashed(const K& k, size_t h) {
+    node* x = load_node(table.load(), h);
+    // the table was replaced since it was loaded
+    while (x == forwarded()) x = load_node(table.load(), h);
+    return find_at(x, k, h);
+  }
+
+  bool insert_hashed(const K& k, const V& v, size_t h) {
+    Table* t;
+    bucket* s;
+    bool r = flck::try_loop([&] {
+      s = update_bucket(h, t);
+      return try_insert_at(s, k, v, h);});
+    after_update(t, s, r, false);
+    return r;
+  }
+
+  template <typename F>
+  bool upsert_hashed(const K& k, const F& f, size_t h) {
+    Table* t;
+    bucket* s;
+    bool r = flck::try_loop([&] {
+      s = update_bucket(h, t);
+      return try_upsert_at(s, k, f, h);});
+    after_update(t, s, r, false);
+    return r;
+  }
+
+  bool remove_hashed(const K& k, size_t h) {
+    Table* t;
+    bucket* s;
+    bool r = flck::try_loop([&] {
+      s = update_bucket(h, t);
+      return try_remove_at(s, k, h);});
+    after_update(t, s, false, r);
+    return r;
+  }
+
+  // doubles the table if it holds more than two entries per bucket and
+  // no resize is in progress
+  void maybe_grow(Table* t) {
+#ifndef UseCAS
+    if (t->migrating()) return;
+    if (counts.get() <= 2 * (long) t->size) return;
+    Table* new_t = table_pool.new_obj(t);
+    if (!table_lock.try_lock([=] {
+	  if (table.load() != t) return false;
+	  table = new_t;
+	  return true;}))
+      table_pool.destruct(new_t);
+    else set_prefetch(new_t);
+#endif
+  }
+
+  // bookkeeping after an update on bucket s of table t
+  void after_update(Table* t, bucket* s, bool inserted, bool removed) {
+    if (inserted) {
+      counts.increment();
+      node* x = s->load();
+      if (x != nullptr && x->cnt > grow_bucket_cnt) maybe_grow(t);
+    } else if (removed) counts.decrement();
+    help_migrate(t);
   }
 
 public:
-  unordered_map(size_t n) : hash_table(Table(n)) {}
+  unordered_map(size_t n) : table(table_pool.new_obj(n)) {
+    set_prefetch(table.load());
+  }
   ~unordered_map() {
-    auto& table = hash_table.table;
-    parlay::parallel_for (0, table.size(), [&] (size_t i) {
-      retire_node(table[i].load());});
+    Table* t = table.load();
+    parlay::parallel_for (0, t->size, [&] (size_t i) {
+      node* x = t->table[i].load();
+      if (x != unmigrated()) retire_node(x);});
+    if (t->migrating()) {
+      Table* old = t->old;
+      parlay::parallel_for (0, old->size, [&] (size_t i) {
+	node* x = old->table[i].load();
+	if (x != forwarded()) retire_node(x);});
+      table_pool.retire(old);
+    }
+    table_pool.retire(t);
   }
   
   std::optional<V> find(const K& k) {
-    bucket* s = hash_table.get_bucket(k);
-    __builtin_prefetch (s);
-    return verlib::with_epoch([&] {
-		return find_at(s->load(), k);});
+    size_t h = Hash{}(k);
+    prefetch(h);
+    return verlib::with_epoch([&] {return find_hashed(k, h);});
   }
 
   std::optional<V> find_(const K& k) {
-    bucket* s = hash_table.get_bucket(k);
-    return find_at(s->load(), k);
+    return find_hashed(k, Hash{}(k));
   }
 
   std::optional<V> find_locked(const K& k) {
-    bucket* s = hash_table.get_bucket(k);
-    return find_at(s->read_lock([=] {return s->load();}), k);
+    size_t h = Hash{}(k);
+    return verlib::with_epoch([&] {
+      while (true) {
+	Table* t;
+	bucket* s = update_bucket(h, t);
+	node* x = s->read_lock([=] {return s->load();});
+	if (x != forwarded()) return find_at(x, k, h);
+      }});
   }
       
   bool insert(const K& k, const V& v) {
-    bucket* s = hash_table.get_bucket(k);
-    __builtin_prefetch (s);
-    return verlib::with_epoch([&] {
-      return flck::try_loop([&] {return try_insert_at(s, k, v);});});
+    size_t h = Hash{}(k);
+    prefetch(h);
+    return verlib::with_epoch([&] {return insert_hashed(k, v, h);});
   }
 
   bool insert_(const K& k, const V& v) {
-    bucket* s = hash_table.get_bucket(k);
-    return flck::try_loop([&] {return try_insert_at(s, k, v);});
+    return insert_hashed(k, v, Hash{}(k));
   }
 
   template <typename F>
   bool upsert(const K& k, const F& f) {
-    bucket* s = hash_table.get_bucket(k);
-    __builtin_prefetch (s);
-    return verlib::with_epoch([&] {
-      return flck::try_loop([&] {return try_upsert_at(s, k, f);});});
+    size_t h = Hash{}(k);
+    prefetch(h);
+    return verlib::with_epoch([&] {return upsert_hashed(k, f, h);});
   }
 
   template <typename F>
   bool upsert_(const K& k, const F& f) {
-    bucket* s = hash_table.get_bucket(k);
-    return flck::try_loop([&] {return try_upsert_at(s, k, f);});
+    return upsert_hashed(k, f, Hash{}(k));
   }
 
   bool remove(const K& k) {
-    bucket* s = hash_table.get_bucket(k);
-    __builtin_prefetch (s);
-    return verlib::with_epoch([&] {
-      return flck::try_loop([&] {return try_remove_at(s, k);});});
+    size_t h = Hash{}(k);
+    prefetch(h);
+    return verlib::with_epoch([&] {return remove_hashed(k, h);});
   }
 
   bool remove_(const K& k) {
-    bucket* s = hash_table.get_bucket(k);
-    return flck::try_loop([&] {return try_remove_at(s, k);});
+    return remove_hashed(k, Hash{}(k));
+  }
+
+  // Batched versions that run the whole batch inside one epoch
+  // announcement.  out[i] is set to the result for keys[i], and the
+  // updates return the number that succeeded.
+  // multi_find works on groups of multi_find_group keys in stages, so
+  // the cache misses within a group overlap: it hashes the keys and
+  // prefetches their buckets, then reads the bucket pointers and
+  // prefetches the nodes (read() does not touch the node, unlike
+  // load(), which reads its stamp), and then loads and searches them.
+  // The updates prefetch the bucket of the key prefetch_distance ahead.
+  static constexpr int multi_find_group = 16;
+  static constexpr int prefetch_distance = 8;
+
+  template <typename Keys, typename Out>
+  void multi_find(const Keys& keys, Out& out) {
+    size_t n = keys.size();
+    verlib::with_epoch([&] {
+      size_t hs[multi_find_group];
+      for (size_t s = 0; s < n; s += multi_find_group) {
+	int m = std::min<size_t>(multi_find_group, n - s);
+	Table* t = table.load();
+	for (int i = 0; i < m; i++) {
+	  hs[i] = Hash{}(keys[s+i]);
+	  __builtin_prefetch (t->get_bucket(hs[i]));
+	}
+	for (int i = 0; i < m; i++)
+	  __builtin_prefetch (t->get_bucket(hs[i])->ptr.read());
+	for (int i = 0; i < m; i++) {
+	  node* x = load_node(t, hs[i]);
+	  // the table was replaced since t was loaded
+	  while (x == forwarded()) x = load_node(table.load(), hs[i]);
+	  out[s+i] = find_at(x, keys[s+i], hs[i]);
+	}
+      }
+      return true;});
   }
 
-  long size() {
-    auto& table = hash_table.table;
-    auto s = parlay::tabulate(table.size(), [&] (size_t i) {
-	      node* x = table[i].load();
+  template <typename KVs>
+  long multi_insert(const KVs& kvs) {
+    size_t n = kvs.size();
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < n; i++) {
+        if (i + prefetch_distance < n)
+          __builtin_prefetch (table.load()->get_bucket(Hash{}(kvs[i + prefetch_distance].first)));
+        cnt += insert_(kvs[i].first, kvs[i].second);
+      }
+      return cnt;});
+  }
+
+  template <typename Keys>
+  long multi_remove(const Keys& keys) {
+    size_t n = keys.size();
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < n; i++) {
+        if (i + prefetch_distance < n)
+          __builtin_prefetch (table.load()->get_bucket(Hash{}(keys[i + prefetch_distance])));
+        cnt += remove_(keys[i]);
+      }
+      return cnt;});
+  }
+
+  // number of entries, exact when no updates are in progress
+  long size() {return counts.get();}
+
+  // number of buckets in the current table
+  size_t capacity() {return table.load()->size;}
+
+  // counts the entries in every bucket.  The unmigrated and forwarded
+  // nodes are empty, so during a resize both tables can be summed
+  long check() {
+    Table* t = table.load();
+    auto sum = [&] (Table* t) {
+      auto s = parlay::tabulate(t->size, [&] (size_t i) {
+	      node* x = t->table[i].load();
 	      if (x == nullptr) return 0;
 	      else return x->cnt;});
-    return parlay::reduce(s);
+      return parlay::reduce(s);};
+    long n = sum(t);
+    if (t->migrating()) n += sum(t->old);
+    return n;
   }
 
   void print() {
-    auto& table = hash_table.table;
-    for (size_t i=0; i < table.size(); i++) {
-      node* x = table[i].ptr.load();
-      if (x != nullptr)
-	for (int i = 0; i < x->cnt; i++) {
-	  K key = (x->cnt < 32) ? x->entries[i].key : ((BigNode*) x)->entries[i].key;
-	  std::cout << key << ", ";
-	}
-    }
+    Table* t = table.load();
+    auto print_table = [&] (Table* t) {
+      for (size_t i=0; i < t->size; i++) {
+	node* x = t->table[i].ptr.load();
+	std::vector<KV> e;
+	std::vector<unsigned char> tags;
+	collect(x, e, tags);
+	for (auto& kv : e)
+	  std::cout << kv.key << ", ";
+      }};
+    print_table(t);
+    if (t->migrating()) print_table(t->old);
     std::cout << std::endl;
   }
 
-  long check() { return size();}
-
   static void clear() {
     node_pool_1.clear();
     node_pool_3.clear();
     node_pool_7.clear();
     node_pool_31.clear();
     big_node_pool.clear();
+    table_pool.clear();
   }
   static void stats() {
     node_pool_1.stats();
@@ -399,8 +827,14 @@ public:
     node_pool_7.stats();
     node_pool_31.stats();
     big_node_pool.stats();
+    table_pool.stats();
+  }
+  // the node sizes taken by n entries at about one per bucket
+  static void reserve(size_t n) {
+    node_pool_1.reserve(2*n/5);
+    node_pool_3.reserve(n/4);
+    node_pool_7.reserve(n/50);
   }
-  static void reserve(size_t n) {}
   static void shuffle(size_t n) {}
 
 };
@@ -415,3 +849,5 @@ template <typename K, typename V, typename H, typename E>
 verlib::memory_pool<typename unordered_map<K,V,H,E>::Node31> unordered_map<K,V,H,E>::node_pool_31;
 template <typename K, typename V, typename H, typename E>
 verlib::memory_pool<typename unordered_map<K,V,H,E>::BigNode> unordered_map<K,V,H,E>::big_node_pool;
+template <typename K, typename V, typename H, typename E>
+verlib::memory_pool<typename unordered_map<K,V,H,E>::Table> unordered_map<K,V,H,E>::table_pool;
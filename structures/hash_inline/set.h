@@ -0,0 +1,3 @@
+#define HASH 1 // indicates that Set needs a hash function
+
+#include "unordered_map.h"
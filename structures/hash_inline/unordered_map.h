@@ -0,0 +1,418 @@
+// MIT license (https://opensource.org/license/mit/)
+
+// A concurrent unordered_map using a hash table whose buckets keep a
+// copy of their entries inline, for small keys and values (e.g. 8
+// bytes each).
+// Supports: fast atomic insert, upsert, remove, and find
+// along with a size kept by per worker counts
+// As in hash_block each bucket points to an immutable Node holding
+// its entries, which is copied on update, and the pointer is
+// versioned.  Updates and snapshots only use the nodes.  In addition
+// each bucket is a cache line holding a copy of the first inline_size
+// entries of its node, so a find outside of a snapshot usually takes
+// a single cache miss.
+// The copy is guarded by a word (cache) holding the node it was copied
+// from, the number of entries and a version.  After an update the
+// copy is rewritten between a CAS that marks the word busy and a store
+// that clears it, as in a seqlock, and a find uses the copy only if
+// the word was not busy, is unchanged after reading the copy, and
+// names the node currently in the bucket.  Otherwise it reads the
+// node.  The copy is written outside of the bucket lock, so lock-free
+// helpers never write it, and the node is stamped before it is
+// copied, so a find using the copy does not need to stamp it.
+// Entries that do not fit in the copy are only in the node.
+// The table does not grow.
+
+#include <parlay/primitives.h>
+#include <verlib/verlib.h>
+#include <verlib/size_counter.h>
+
+template <typename K,
+	  typename V,
+	  class Hash = std::hash<K>,
+	  class KeyEqual = std::equal_to<K>>
+struct unordered_map {
+private:
+  struct KV {K key; V value;};
+  static_assert(std::is_trivially_copyable_v<KV>,
+		"hash_inline needs trivially copyable keys and values");
+
+  struct BigNode;
+
+  // Nodes come in sizes 1, 3, 7 and 31, and larger ones are BigNodes.
+  // The actual number of entries is given by cnt.
+  template <int Size>
+  struct Node : verlib::versioned {
+    using node = Node<0>;
+    int cnt;
+    KV entries[Size];
+
+    KV* get_entries() {
+      if (cnt <= 31) return ((Node<31>*) this)->entries;
+      else return ((BigNode*) this)->entries.data();
+    }
+
+    // return index of key in entries, or -1 if not found
+    int find_index(const K& k) {
+      KV* e = get_entries();
+      for (int i=0; i < cnt; i++)
+	if (KeyEqual{}(e[i].key, k)) return i;
+      return -1;
+    }
+
+    Node(const KV* e, int n) : cnt(n) {
+      for (int i=0; i < n; i++) entries[i] = e[i];
+    }
+  };
+  using node = Node<0>;
+
+  struct BigNode : verlib::versioned {
+    int cnt;
+    std::vector<KV> entries;
+    BigNode(std::vector<KV> e) : cnt(e.size()), entries(std::move(e)) {}
+  };
+
+  struct bucket_head
+#ifndef UseCAS
+    : verlib::lock
+#endif
+  {
+    node* load() {return ptr.load();}
+    verlib::versioned_ptr<node> ptr;
+    // the node the copy is from in the low 48 bits, with bit 0 set
+    // while the copy is being written, then 4 bits with the number of
+    // entries copied (inline_size + 1 if the node has more), and a 12
+    // bit version
+    std::atomic<size_t> cache;
+    bucket_head() : ptr(nullptr), cache(0) {}
+  };
+
+  // as many entries as fit in the rest of the cache line
+  static constexpr int inline_size =
+    std::clamp<int>((64 - (int) sizeof(bucket_head)) / (int) sizeof(KV), 1, 14);
+
+  struct alignas(64) bucket : bucket_head {
+    KV entries[inline_size];
+  };
+
+  static constexpr size_t busy = 1;
+  static size_t cache_word(node* x, int n, size_t version) {
+    return ((size_t) x) | ((size_t) n << 48) | (version << 52);}
+  static node* cached_node(size_t w) {
+    return (node*) (w & ((1ul << 48) - 1));}
+  static int cached_cnt(size_t w) {return (w >> 48) & 15;}
+
+  bucket* table;
+  size_t size_;
+
+  // number of entries, exact when no updates are in progress
+  verlib::size_counter counts;
+
+  bucket* get_bucket(size_t h) {
+    return &table[h & (size_-1u)];
+  }
+
+  using Node1 = Node<1>;
+  using Node3 = Node<3>;
+  using Node7 = Node<7>;
+  using Node31 = Node<31>;
+  static verlib::memory_pool<Node1> node_pool_1;
+  static verlib::memory_pool<Node3> node_pool_3;
+  static verlib::memory_pool<Node7> node_pool_7;
+  static verlib::memory_pool<Node31> node_pool_31;
+  static verlib::memory_pool<BigNode> big_node_pool;
+
+  // a copy of old without entry skip (if not -1), and with add (if
+  // not null) at the end
+  static node* new_node(node* old, int skip, const KV* add) {
+    int m = (old == nullptr) ? 0 : old->cnt;
+    int n = m - (skip != -1) + (add != nullptr);
+    if (n == 0) return nullptr;
+    auto fill = [&] (KV* e) {
+      KV* old_e = (m == 0) ? nullptr : old->get_entries();
+      int j = 0;
+      for (int i=0; i < m; i++)
+	if (i != skip) e[j++] = old_e[i];
+      if (add != nullptr) e[j] = *add;};
+    if (n > 31) {
+      std::vector<KV> e(n);
+      fill(e.data());
+      return (node*) big_node_pool.new_obj(std::move(e));
+    }
+    KV e[31];
+    fill(e);
+    if (n == 1) return (node*) node_pool_1.new_obj(e, n);
+    else if (n <= 3) return (node*) node_pool_3.new_obj(e, n);
+    else if (n <= 7) return (node*) node_pool_7.new_obj(e, n);
+    else return (node*) node_pool_31.new_obj(e, n);
+  }
+
+  static void retire_node(node* x) {
+    if (x == nullptr);
+    else if (x->cnt == 1) node_pool_1.retire((Node1*) x);
+    else if (x->cnt <= 3) node_pool_3.retire((Node3*) x);
+    else if (x->cnt <= 7) node_pool_7.retire((Node7*) x);
+    else if (x->cnt <= 31) node_pool_31.retire((Node31*) x);
+    else big_node_pool.retire((BigNode*) x);
+  }
+
+  static void destruct_node(node* x) {
+    if (x == nullptr);
+    else if (x->cnt == 1) node_pool_1.destruct((Node1*) x);
+    else if (x->cnt <= 3) node_pool_3.destruct((Node3*) x);
+    else if (x->cnt <= 7) node_pool_7.destruct((Node7*) x);
+    else if (x->cnt <= 31) node_pool_31.destruct((Node31*) x);
+    else big_node_pool.destruct((BigNode*) x);
+  }
+
+  static std::optional<V> find_in(node* x, const K& k) {
+    if (x == nullptr) return {};
+    int i = x->find_index(k);
+    if (i == -1) return {};
+    else return x->get_entries()[i].value;
+  }
+
+  // Brings the copy in bucket s up to date with its node.  If another
+  // thread is writing the copy it gives up, since that thread checks
+  // the node again when done.
+  static void refresh(bucket* s) {
+    while (true) {
+      size_t w = s->cache.load();
+      if (w & busy) return;
+      node* x = s->load(); // stamps x
+      if (cached_node(w) == x) return;
+      size_t version = ((w >> 52) + 1) & 0xfff;
+      if (!s->cache.compare_exchange_strong(w, busy | (version << 52)))
+	return;
+      int n = (x == nullptr) ? 0 : x->cnt;
+      KV* e = (x == nullptr) ? nullptr : x->get_entries();
+      for (int i=0; i < std::min(n, inline_size); i++)
+	s->entries[i] = e[i];
+      s->cache = cache_word(x, std::min(n, inline_size + 1), version);
+    }
+  }
+
+  // find a key at the given bucket, using the copy if it is current
+  static std::optional<V> find_at(bucket* s, const K& k) {
+#ifdef Versioned
+    if (verlib::local_stamp == -1)
+#endif
+    {
+      size_t w = s->cache.load(std::memory_order_acquire);
+      KV e[inline_size];
+      for (int i=0; i < inline_size; i++) e[i] = s->entries[i];
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (!(w & busy) &&
+	  s->cache.load(std::memory_order_relaxed) == w &&
+	  s->ptr.read() == cached_node(w)) {
+	int n = cached_cnt(w);
+	for (int i=0; i < std::min(n, inline_size); i++)
+	  if (KeyEqual{}(e[i].key, k)) return e[i].value;
+	if (n <= inline_size) return {};
+      }
+    }
+    return find_in(s->load(), k);
+  }
+
+  // try to install a new node in bucket s
+  static std::optional<bool> try_update(bucket* s, node* old_node, node* new_node, bool ret_val) {
+#ifdef UseCAS
+    if (s->load() == old_node &&
+	s->ptr.cas(old_node, new_node))
+#else  // use try_lock
+    if (s->try_lock([=] {
+	    if (s->load() != old_node) return false;
+	    s->ptr = new_node;
+	    return true;}))
+#endif
+    {
+      retire_node(old_node);
+      return ret_val;
+    }
+    destruct_node(new_node);
+    return {};
+  }
+
+  static std::optional<bool> try_insert_at(bucket* s, const K& k, const V& v) {
+    node* old_node = s->load();
+    if (find_in(old_node, k).has_value()) {
+#ifndef UseCAS
+      if (s->read_lock([&] {return s->load() == old_node;})) return false;
+      else return {};
+#else
+      return false;
+#endif
+    }
+    KV kv{k, v};
+    return try_update(s, old_node, new_node(old_node, -1, &kv), true);
+  }
+
+  template <typename F>
+  static std::optional<bool> try_upsert_at(bucket* s, const K& k, F& f) {
+    node* old_node = s->load();
+    int i = (old_node == nullptr) ? -1 : old_node->find_index(k);
+    if (i == -1) {
+      KV kv{k, f(std::optional<V>())};
+      return try_update(s, old_node, new_node(old_node, -1, &kv), true);
+    }
+#ifdef UseCAS
+    KV kv{k, f(old_node->get_entries()[i].value)};
+    return try_update(s, old_node, new_node(old_node, i, &kv), false);
+#else  // use try_lock
+    if (s->try_lock([=] {
+	  if (s->load() != old_node) return false;
+	  KV kv{k, f(old_node->get_entries()[i].value)}; // f applied within lock
+	  s->ptr = new_node(old_node, i, &kv);
+	  return true;})) {
+      retire_node(old_node);
+      return false;
+    } else return {};
+#endif
+  }
+
+  static std::optional<bool> try_remove_at(bucket* s, const K& k) {
+    node* old_node = s->load();
+    int i = (old_node == nullptr) ? -1 : old_node->find_index(k);
+    if (i == -1) {
+#ifndef UseCAS
+      if (s->read_lock([&] {return s->load() == old_node;})) return false;
+      else return {};
+#else
+      return false;
+#endif
+    }
+    return try_update(s, old_node, new_node(old_node, i, nullptr), true);
+  }
+
+public:
+  unordered_map(size_t n) {
+    int bits = parlay::log2_up(n);
+    size_ = 1ul << bits;
+    table = std::allocator<bucket>().allocate(size_);
+    for (size_t i=0; i < size_; i++) new (&table[i]) bucket();
+  }
+  ~unordered_map() {
+    parlay::parallel_for (0, size_, [&] (size_t i) {
+      retire_node(table[i].load());
+      table[i].~bucket();});
+    std::allocator<bucket>().deallocate(table, size_);
+  }
+
+  std::optional<V> find(const K& k) {
+    bucket* s = get_bucket(Hash{}(k));
+    __builtin_prefetch (s);
+    return verlib::with_epoch([&] {return find_at(s, k);});
+  }
+
+  std::optional<V> find_(const K& k) {
+    return find_at(get_bucket(Hash{}(k)), k);
+  }
+
+  bool insert(const K& k, const V& v) {
+    bucket* s = get_bucket(Hash{}(k));
+    __builtin_prefetch (s);
+    return verlib::with_epoch([&] {return insert_at(s, k, v);});
+  }
+
+  bool insert_(const K& k, const V& v) {
+    return insert_at(get_bucket(Hash{}(k)), k, v);
+  }
+
+  template <typename F>
+  bool upsert(const K& k, const F& f) {
+    bucket* s = get_bucket(Hash{}(k));
+    __builtin_prefetch (s);
+    return verlib::with_epoch([&] {return upsert_at(s, k, f);});
+  }
+
+  template <typename F>
+  bool upsert_(const K& k, const F& f) {
+    return upsert_at(get_bucket(Hash{}(k)), k, f);
+  }
+
+  bool remove(const K& k) {
+    bucket* s = get_bucket(Hash{}(k));
+    __builtin_prefetch (s);
+    return verlib::with_epoch([&] {return remove_at(s, k);});
+  }
+
+  bool remove_(const K& k) {
+    return remove_at(get_bucket(Hash{}(k)), k);
+  }
+
+  // number of entries, exact when no updates are in progress
+  long size() {return counts.get();}
+
+  // counts the entries in every bucket
+  long check() {
+    auto s = parlay::tabulate(size_, [&] (size_t i) {
+	       node* x = table[i].load();
+	       if (x == nullptr) return 0;
+	       else return x->cnt;});
+    return parlay::reduce(s);
+  }
+
+  void print() {
+    for (size_t i=0; i < size_; i++) {
+      node* x = table[i].load();
+      if (x != nullptr)
+	for (int j=0; j < x->cnt; j++)
+	  std::cout << x->get_entries()[j].key << ", ";
+    }
+    std::cout << std::endl;
+  }
+
+  static void clear() {
+    node_pool_1.clear();
+    node_pool_3.clear();
+    node_pool_7.clear();
+    node_pool_31.clear();
+    big_node_pool.clear();
+  }
+  static void stats() {
+    node_pool_1.stats();
+    node_pool_3.stats();
+    node_pool_7.stats();
+    node_pool_31.stats();
+    big_node_pool.stats();
+  }
+  // the node sizes taken by n entries at about one per bucket
+  static void reserve(size_t n) {
+    node_pool_1.reserve(2*n/5);
+    node_pool_3.reserve(n/4);
+    node_pool_7.reserve(n/50);
+  }
+  static void shuffle(size_t n) {}
+
+private:
+  bool insert_at(bucket* s, const K& k, const V& v) {
+    bool r = flck::try_loop([&] {return try_insert_at(s, k, v);});
+    if (r) {refresh(s); counts.increment();}
+    return r;
+  }
+
+  template <typename F>
+  bool upsert_at(bucket* s, const K& k, const F& f) {
+    bool r = flck::try_loop([&] {return try_upsert_at(s, k, f);});
+    refresh(s);
+    if (r) counts.increment();
+    return r;
+  }
+
+  bool remove_at(bucket* s, const K& k) {
+    bool r = flck::try_loop([&] {return try_remove_at(s, k);});
+    if (r) {refresh(s); counts.decrement();}
+    return r;
+  }
+};
+
+template <typename K, typename V, typename H, typename E>
+verlib::memory_pool<typename unordered_map<K,V,H,E>::Node1> unordered_map<K,V,H,E>::node_pool_1;
+template <typename K, typename V, typename H, typename E>
+verlib::memory_pool<typename unordered_map<K,V,H,E>::Node3> unordered_map<K,V,H,E>::node_pool_3;
+template <typename K, typename V, typename H, typename E>
+verlib::memory_pool<typename unordered_map<K,V,H,E>::Node7> unordered_map<K,V,H,E>::node_pool_7;
+template <typename K, typename V, typename H, typename E>
+verlib::memory_pool<typename unordered_map<K,V,H,E>::Node31> unordered_map<K,V,H,E>::node_pool_31;
+template <typename K, typename V, typename H, typename E>
+verlib::memory_pool<typename unordered_map<K,V,H,E>::BigNode> unordered_map<K,V,H,E>::big_node_pool;
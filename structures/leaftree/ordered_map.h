@@ -1,5 +1,6 @@
 #include <verlib/verlib.h>
 #include <parlay/parallel.h>
+#include <verlib/size_counter.h>
 
 template <typename K,
 	  typename V,
@@ -8,6 +9,7 @@ struct ordered_map {
 
   struct internal;
   internal* root;
+  verlib::size_counter counts; // number of keys, see size()
   
   // common header for internal nodes and leaves
   struct node : verlib::versioned {
@@ -65,12 +67,64 @@ struct ordered_map {
   }
 
   bool insert_(const K& k, const V& v) {
-    return flck::try_loop([&] {return try_insert(k, v);});}
+    bool r = flck::try_loop([&] {return try_insert(k, v);});
+    if (r) counts.increment();
+    return r;}
   
   bool upsert(const K& k, const V& v) {
-    return verlib::with_epoch([=] {
-      return flck::try_loop([&] {return try_insert(k, v, true);});
-    });
+    return upsert(k, [=] (const std::optional<V>&) {return v;});
+  }
+
+  // Read-modify-write upsert and update, as in btree.
+  template <typename F,
+	    typename = std::enable_if_t<std::is_invocable_v<F, std::optional<V>>>>
+  bool upsert_(const K& k, const F& f) {
+    bool r = !flck::try_loop([&] {return try_apply(k, f, true);});
+    if (r) counts.increment();
+    return r;}
+
+  template <typename F,
+	    typename = std::enable_if_t<std::is_invocable_v<F, std::optional<V>>>>
+  bool upsert(const K& k, const F& f) {
+    return verlib::with_epoch([&] {return upsert_(k, f);});}
+
+  template <typename F>
+  bool update_(const K& k, const F& f) {
+    return flck::try_loop([&] {
+      return try_apply(k, [f] (const std::optional<V>& v) {return f(*v);}, false);});}
+
+  template <typename F>
+  bool update(const K& k, const F& f) {
+    return verlib::with_epoch([&] {return update_(k, f);});}
+
+  // As in btree, but a present key's leaf is replaced by a new one
+  // under the lock of its parent.
+  template <typename F>
+  std::optional<bool> try_apply(const K& k, const F& f, bool insert_if_absent) {
+    auto [gp, gp_left, p, p_left, l] = find_location(root, k);
+    auto ptr = p_left ? &(p->left) : &(p->right);
+    if (!Equal(k, l)) {
+      if (!insert_if_absent)
+	if (p->lck.read_lock([&] {return (ptr->load() == (node*) l) && !p->removed.load();}))
+	  return false;
+	else return {};
+      if (p->lck.try_lock([=] {
+	  if (p->removed.load() || ptr->load() != (node*) l) return false;
+	  node* new_l = leaf_pool.new_obj(k, f(std::optional<V>()));
+	  *ptr = (Less(k, l) ?
+		  internal_pool.new_obj(l->key, new_l, l) :
+		  internal_pool.new_obj(k, l, new_l));
+	  return true;}))
+	return false;
+      else return {};
+    }
+    if (p->lck.try_lock([=] {
+	if (p->removed.load() || ptr->load() != (node*) l) return false;
+	*ptr = leaf_pool.new_obj(k, f(std::optional<V>(l->value)));
+	leaf_pool.retire(l);
+	return true;}))
+      return true;
+    else return {};
   }
 
   bool insert(const K& k, const V& v) {
@@ -102,7 +156,9 @@ struct ordered_map {
   }
 
   bool remove_(const K& k) {
-    return flck::try_loop([&] {	return try_remove(k); });}
+    bool r = flck::try_loop([&] {	return try_remove(k); });
+    if (r) counts.decrement();
+    return r;}
 
   bool remove(const K& k) {
     return verlib::with_epoch([=] { return remove_(k);});}
@@ -150,6 +206,32 @@ struct ordered_map {
   std::optional<V> find(const K& k) {
     return verlib::with_epoch([&] { return find_(k);});}
 
+  // Batched versions that run the whole batch inside one epoch
+  // announcement.  out[i] is set to the result for keys[i], and the
+  // updates return the number that succeeded.
+  template <typename Keys, typename Out>
+  void multi_find(const Keys& keys, Out& out) {
+    verlib::with_epoch([&] {
+      for (size_t i = 0; i < keys.size(); i++) out[i] = find_(keys[i]);});
+  }
+
+  template <typename KVs>
+  long multi_insert(const KVs& kvs) {
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < kvs.size(); i++)
+        cnt += insert_(kvs[i].first, kvs[i].second);
+      return cnt;});
+  }
+
+  template <typename Keys>
+  long multi_remove(const Keys& keys) {
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < keys.size(); i++) cnt += remove_(keys[i]);
+      return cnt;});
+  }
+
   std::optional<V> find_locked(const K& k) {
     return flck::try_loop([&] {return try_find(k);});}
 
@@ -164,6 +246,71 @@ struct ordered_map {
     return ot();
   }
 
+  // Ordered queries.  lower_bound finds the first key not less than
+  // k, successor the first key greater than k, and predecessor the
+  // last key less than k.  The versions with an underscore can be used
+  // inside a snapshot (or on their own, but then they are not atomic),
+  // the others take their own snapshot.
+  // On the way down to k's leaf keeps the last subtree branched away
+  // from on the appropriate side.  If the leaf does not qualify, the
+  // answer is the extreme leaf of that subtree.
+  using kv_opt = std::optional<std::pair<K,V>>;
+
+  // first with key >= k (> k if strict), or the smallest if k is null
+  kv_opt next_internal(const K* k, bool strict) {
+    node* a = (root->left).load();
+    node* other = nullptr;
+    while (!a->is_leaf) {
+      internal* p = (internal*) a;
+      if (k == nullptr || Less(*k, p)) {
+	other = (p->right).load();
+	a = (p->left).load();
+      } else a = (p->right).load();
+    }
+    leaf* l = (leaf*) a;
+    if (!l->is_sentinal &&
+	(k == nullptr || (strict ? Compare{}(*k, l->key) : !Compare{}(l->key, *k))))
+      return std::pair(l->key, l->value);
+    if (other == nullptr) return {};
+    while (!other->is_leaf) other = (((internal*) other)->left).load();
+    return std::pair(other->key, ((leaf*) other)->value);
+  }
+
+  // last with key < k, or the largest if k is null
+  kv_opt prev_internal(const K* k) {
+    node* a = (root->left).load();
+    node* other = nullptr;
+    while (!a->is_leaf) {
+      internal* p = (internal*) a;
+      if (k == nullptr || !Less(*k, p)) {
+	other = (p->left).load();
+	a = (p->right).load();
+      } else a = (p->left).load();
+    }
+    leaf* l = (leaf*) a;
+    if (!l->is_sentinal && (k == nullptr || Compare{}(l->key, *k)))
+      return std::pair(l->key, l->value);
+    if (other == nullptr) return {};
+    while (!other->is_leaf) other = (((internal*) other)->right).load();
+    if (other->is_sentinal) return {};
+    return std::pair(other->key, ((leaf*) other)->value);
+  }
+
+  kv_opt lower_bound_(const K& k) {return next_internal(&k, false);}
+  kv_opt successor_(const K& k) {return next_internal(&k, true);}
+  kv_opt predecessor_(const K& k) {return prev_internal(&k);}
+  kv_opt min_() {return next_internal(nullptr, false);}
+  kv_opt max_() {return prev_internal(nullptr);}
+
+  kv_opt lower_bound(const K& k) {
+    return verlib::with_snapshot([&] {return lower_bound_(k);});}
+  kv_opt successor(const K& k) {
+    return verlib::with_snapshot([&] {return successor_(k);});}
+  kv_opt predecessor(const K& k) {
+    return verlib::with_snapshot([&] {return predecessor_(k);});}
+  kv_opt min() {return verlib::with_snapshot([&] {return min_();});}
+  kv_opt max() {return verlib::with_snapshot([&] {return max_();});}
+
   ordered_map() : root(internal_pool.new_obj(leaf_pool.new_obj())) {}
   ordered_map(size_t n) : root(internal_pool.new_obj(leaf_pool.new_obj())) {}
   ~ordered_map() { retire(root);}
@@ -210,6 +357,9 @@ struct ordered_map {
     return hrec(root->left.load(), 1);
   }
 
+  // number of keys, exact when no updates are in progress
+  long size() {return counts.get();}
+
   long check() {
     using rtup = std::tuple<K, K, long>;
     std::function<rtup(node*,bool)> crec;
@@ -61,6 +61,72 @@ struct ordered_map {
   bool insert(const K& k, const V& v) {
     return verlib::with_epoch([=] {return insert_(k, v);}); }
 
+  // Read-modify-write upsert and update, as in btree.
+  template <typename F,
+            typename = std::enable_if_t<std::is_invocable_v<F, std::optional<V>>>>
+  bool upsert_(const K& k, const F& f) {
+    return !flck::try_loop([&] {return try_apply(k, f, true);});}
+
+  template <typename F,
+            typename = std::enable_if_t<std::is_invocable_v<F, std::optional<V>>>>
+  bool upsert(const K& k, const F& f) {
+    return verlib::with_epoch([&] {return upsert_(k, f);}); }
+
+  bool upsert(const K& k, const V& v) {
+    return upsert(k, [=] (const std::optional<V>&) {return v;}); }
+
+  template <typename F>
+  bool update_(const K& k, const F& f) {
+    return flck::try_loop([&] {
+      return try_apply(k, [f] (const std::optional<V>& v) {return f(*v);}, false);});}
+
+  template <typename F>
+  bool update(const K& k, const F& f) {
+    return verlib::with_epoch([&] {return update_(k, f);}); }
+
+  // As in btree, but a present key's node is replaced by a copy,
+  // locking the node and its predecessor as in remove.
+  template <typename F>
+  std::optional<bool> try_apply(const K& k, const F& f, bool insert_if_absent) {
+    auto [cur, nxt] = find_location(root, k);
+    if (nxt->is_end || less(k, nxt->key)) { // not found
+      if (!insert_if_absent)
+        if (cur->lck.read_lock([&] {return (cur->next.load() == nxt) && !cur->removed.load();}))
+          return false;
+        else return {};
+      if (cur->lck.try_lock([=] {
+        if (!cur->removed.load() && (cur->next).load() == nxt) {
+          cur->next = node_pool.new_obj(k, f(std::optional<V>()), nxt); // splice in
+          return true;
+        } else return false;})) return false;
+      else return {};
+    }
+    if (cur->lck.try_lock([=] {
+        if (cur->removed.load() || (cur->next).load() != nxt)
+	  return false;
+	return nxt->lck.try_lock([=] {
+        node* nxtnxt = (nxt->next).load();
+        V v = f(std::optional<V>(nxt->value));
+#ifdef Recorded_Once
+	// if recoreded once then need to copy nxtnxt and point to it
+	return nxtnxt->lck.try_lock([=] {
+          nxt->removed = true;
+	  nxtnxt->removed = true;
+	  cur->next = node_pool.new_obj(k, v, node_pool.new_obj(nxtnxt));
+	  node_pool.retire(nxt);
+	  node_pool.retire(nxtnxt); 
+	  return true;});
+#else
+	nxt->removed = true;
+	cur->next = node_pool.new_obj(k, v, nxtnxt); // replace nxt
+	node_pool.retire(nxt);
+	return true;
+#endif
+        });}))
+      return true;
+    else return {};
+  }
+
   std::optional<bool> try_remove(const K& k) {
     auto [cur, nxt] = find_location(root, k);
     if (nxt->is_end || less(k, nxt->key)) // not found
@@ -122,6 +188,32 @@ struct ordered_map {
     return verlib::with_epoch([&] {return find_(k);});
   }
 
+  // Batched versions that run the whole batch inside one epoch
+  // announcement.  out[i] is set to the result for keys[i], and the
+  // updates return the number that succeeded.
+  template <typename Keys, typename Out>
+  void multi_find(const Keys& keys, Out& out) {
+    verlib::with_epoch([&] {
+      for (size_t i = 0; i < keys.size(); i++) out[i] = find_(keys[i]);});
+  }
+
+  template <typename KVs>
+  long multi_insert(const KVs& kvs) {
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < kvs.size(); i++)
+        cnt += insert_(kvs[i].first, kvs[i].second);
+      return cnt;});
+  }
+
+  template <typename Keys>
+  long multi_remove(const Keys& keys) {
+    return verlib::with_epoch([&] {
+      long cnt = 0;
+      for (size_t i = 0; i < keys.size(); i++) cnt += remove_(keys[i]);
+      return cnt;});
+  }
+
   template<typename AddF>
   void range_(AddF& add, const K& start, const K& end) {
     node* nxt = (root->next).load();
@@ -142,6 +234,58 @@ struct ordered_map {
     }
   }
 
+  // Ordered queries.  lower_bound finds the first key not less than
+  // k, successor the first key greater than k, and predecessor the
+  // last key less than k.  The versions with an underscore can be used
+  // inside a snapshot (or on their own), the others take their own
+  // snapshot.  max is linear time.
+  using kv_opt = std::optional<std::pair<K,V>>;
+
+  kv_opt lower_bound_(const K& k) {
+    auto [cur, nxt] = find_location(root, k);
+    if (nxt->is_end) return {};
+    return std::pair(nxt->key, nxt->value);
+  }
+
+  kv_opt successor_(const K& k) {
+    auto [cur, nxt] = find_location(root, k);
+    if (!nxt->is_end && !less(k, nxt->key)) nxt = (nxt->next).load();
+    if (nxt->is_end) return {};
+    return std::pair(nxt->key, nxt->value);
+  }
+
+  kv_opt predecessor_(const K& k) {
+    auto [cur, nxt] = find_location(root, k);
+    if (cur == root) return {};
+    return std::pair(cur->key, cur->value);
+  }
+
+  kv_opt min_() {
+    node* nxt = (root->next).load();
+    if (nxt->is_end) return {};
+    return std::pair(nxt->key, nxt->value);
+  }
+
+  kv_opt max_() {
+    node* cur = root;
+    node* nxt = (cur->next).load();
+    while (!nxt->is_end) {
+      cur = nxt;
+      nxt = (nxt->next).load();
+    }
+    if (cur == root) return {};
+    return std::pair(cur->key, cur->value);
+  }
+
+  kv_opt lower_bound(const K& k) {
+    return verlib::with_snapshot([&] {return lower_bound_(k);});}
+  kv_opt successor(const K& k) {
+    return verlib::with_snapshot([&] {return successor_(k);});}
+  kv_opt predecessor(const K& k) {
+    return verlib::with_snapshot([&] {return predecessor_(k);});}
+  kv_opt min() {return verlib::with_snapshot([&] {return min_();});}
+  kv_opt max() {return verlib::with_snapshot([&] {return max_();});}
+
   ordered_map() : root(node_pool.new_obj(node_pool.new_obj(nullptr,true),false)) {}
   ordered_map(size_t n) : root(node_pool.new_obj(node_pool.new_obj(nullptr,true),false)) {}
 